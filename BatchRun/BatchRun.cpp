@@ -0,0 +1,226 @@
+#include "stdafx.h"
+#include "BatchRun.h"
+#include "Daemon.h"
+
+using namespace std;
+using boost::filesystem::path;
+
+int BatchRun::Main(const int argc, const char* const argv[])
+{
+	// Narrow paths are UTF-8 on every platform, Windows gets UTF-8 arguments from the code page of BatchRun.manifest:
+	const auto unusedLocale(path::imbue(locale(locale(), new boost::filesystem::detail::utf8_codecvt_facet)));
+
+	Options opts;
+	if (not ParseArgs(argc, argv, &opts))
+	{
+		cerr << usage << endl;
+		return 2;
+	}
+	if (opts.mode == MODE::CLIENT) return Daemon::Submit(opts.socketPath, MakeJobs(opts));
+
+	shared_ptr<const PianoToMidi::RnnModels> models;
+	try
+	{
+		string log;
+		models = PianoToMidi::LoadModels(opts.modelsDir.string(), &log);
+		if (not log.empty()) cout << log << endl;
+	}
+	catch (const KerasError& e)
+	{
+		cerr << "Could not load RNN models: " << e.what() << endl;
+		return 1;
+	}
+	if (opts.mode == MODE::DAEMON)
+		return Daemon(models, opts.nWorkers, opts.maxInFlight, opts.windowSeconds).Serve(opts.socketPath);
+	return RunBatch(opts, models);
+}
+
+int BatchRun::RunBatch(const Options& opts, const shared_ptr<const PianoToMidi::RnnModels>& models)
+{
+	const auto jobs(MakeJobs(opts));
+
+	// Files take very different time, so every worker takes the next one, as soon as it is free:
+	atomic<size_t> next(0), nFailed(0);
+	mutex coutLock;
+	const auto Worker([&jobs, &opts, &models, &next, &nFailed, &coutLock]()
+	{
+		for (auto i(next++); i < jobs.size(); i = next++)
+		{
+			string error;
+			const auto json(Transcribe(jobs.at(i), opts.windowSeconds, models, &error));
+			boost::filesystem::ofstream jsonFile(jobs.at(i).jsonFile);
+			jsonFile << json;
+			if (not jsonFile and error.empty()) error = "Could not write summary file: " + jobs.at(i).jsonFile.string();
+			if (not error.empty()) ++nFailed;
+
+			const lock_guard<mutex> lock(coutLock);
+			cout << (error.empty() ? "Done:\t" : "Failed:\t") << jobs.at(i).mediaFile.string();
+			if (error.empty()) cout << " -> " << jobs.at(i).midiFile.string() << endl;
+			else cout << endl << '\t' << error << endl;
+		}
+	});
+	vector<thread> workers;
+	for (size_t i(1); i < min(opts.nWorkers, jobs.size()); ++i) workers.emplace_back(Worker);
+	Worker();
+	for (auto& worker : workers) worker.join();
+
+	cout << jobs.size() - nFailed << " of " << jobs.size() << " files transcribed" << endl;
+	return nFailed ? 1 : 0;
+}
+
+bool BatchRun::ParseArgs(const int argc, const char* const argv[], Options* opts)
+{
+	// Models are in the current folder, the same as TestRun looks for them:
+	opts->mode = MODE::BATCH;
+	opts->nWorkers = max(thread::hardware_concurrency(), 1u);
+	opts->maxInFlight = 0;
+	opts->windowSeconds = 120;
+	opts->outDir = boost::filesystem::current_path();
+	opts->modelsDir = boost::filesystem::current_path();
+	opts->socketPath = (boost::filesystem::temp_directory_path() / "PianoToMidi.sock").string();
+	try
+	{
+		for (auto i(1); i < argc; ++i)
+		{
+			const string arg(argv[i]);
+			if (arg == "-d") opts->mode = MODE::DAEMON;
+			else if (arg == "-c") opts->mode = MODE::CLIENT;
+			else if (arg.size() == 2 and arg.front() == '-')
+			{
+				if (++i == argc) return false;
+				switch (arg.back())
+				{
+				case 'j': opts->nWorkers = stoul(argv[i]); break;
+				case 'q': opts->maxInFlight = stoul(argv[i]); break;
+				case 'w': opts->windowSeconds = stoul(argv[i]); break;
+				case 's': opts->socketPath = argv[i]; break;
+				case 'o': opts->outDir = boost::filesystem::absolute(path(argv[i])); break;
+				case 'm': opts->modelsDir = boost::filesystem::absolute(path(argv[i])); break;
+				default: return false;
+				}
+			}
+			else if (is_directory(path(arg)))
+			{
+				const auto found(FindMedia(path(arg)));
+				opts->mediaFiles.insert(opts->mediaFiles.end(), found.cbegin(), found.cend());
+			}
+			else opts->mediaFiles.emplace_back(boost::filesystem::absolute(path(arg)));
+		}
+		create_directories(opts->outDir);
+	}
+	catch (const logic_error& e)
+	{
+		cerr << e.what() << endl;
+		return false;
+	}
+	catch (const boost::filesystem::filesystem_error& e)
+	{
+		cerr << e.what() << endl;
+		return false;
+	}
+	// Jobs wait in the daemon queue, while all the workers are busy, twice as many of them are in flight by default:
+	if (opts->maxInFlight == 0) opts->maxInFlight = 2 * opts->nWorkers;
+	return opts->nWorkers and opts->maxInFlight >= opts->nWorkers and opts->windowSeconds
+		and opts->mediaFiles.empty() == (opts->mode == MODE::DAEMON);
+}
+
+vector<path> BatchRun::FindMedia(const path& folder)
+{
+	// FFmpeg can decode many more, but other files in the same folder are not tried, only the usual audio ones:
+	static const array<string, 12> extensions{ ".aac", ".aif", ".aiff", ".ape", ".flac", ".m4a",
+		".mp3", ".mp4", ".ogg", ".opus", ".wav", ".wma" };
+	vector<path> result;
+	for (boost::filesystem::recursive_directory_iterator iter(folder), end; iter != end; ++iter)
+	{
+		if (not is_regular_file(iter->status())) continue;
+		auto ext(iter->path().extension().string());
+		for (auto& c : ext) c = static_cast<char>(tolower(static_cast<unsigned char>(c))); // ASCII only
+		if (find(extensions.cbegin(), extensions.cend(), ext) != extensions.cend()) result.push_back(iter->path());
+	}
+	sort(result.begin(), result.end());
+	return result;
+}
+
+vector<BatchRun::Job> BatchRun::MakeJobs(const Options& opts)
+{
+	// Files of the same name from different folders get numbers, so that no two workers write the same output:
+	vector<Job> result;
+	vector<string> names;
+	for (const auto& mediaFile : opts.mediaFiles)
+	{
+		auto name(mediaFile.stem().string());
+		for (auto n(2); find(names.cbegin(), names.cend(), name) != names.cend(); ++n)
+			name = mediaFile.stem().string() + " (" + to_string(n) + ')';
+		names.push_back(name);
+		result.push_back({ mediaFile, opts.outDir / path(name + ".mid"), opts.outDir / path(name + ".json") });
+	}
+	return result;
+}
+
+string BatchRun::Transcribe(const Job& job, const size_t windowSeconds,
+	const shared_ptr<const PianoToMidi::RnnModels>& models, string* error)
+{
+	string json;
+	try
+	{
+		const PianoToMidi piano;
+		piano.UseModels(models);
+		const auto unusedLog(piano.TranscribeWindowed(job.mediaFile.string().c_str(), "",
+			job.midiFile.string(), windowSeconds));
+		json = SummaryJson(job, piano.GetSummary());
+	}
+	catch (const exception& e)
+	{
+		*error = e.what();
+		json = "{\n\t\"audio\": " + JsonString(job.mediaFile.string())
+			+ ",\n\t\"error\": " + JsonString(*error) + "\n}\n";
+	}
+	return move(json);
+}
+
+string BatchRun::SummaryJson(const Job& job, const PianoToMidi::Summary& summary)
+{
+	// Resident memory is of the whole process, all the files transcribed by it so far:
+	ostringstream os;
+	os << fixed << setprecision(2) << "{\n"
+		<< "\t\"audio\": " << JsonString(job.mediaFile.string()) << ",\n"
+		<< "\t\"midi\": " << JsonString(job.midiFile.string()) << ",\n"
+		<< "\t\"audioSeconds\": " << summary.audioSeconds << ",\n"
+		<< "\t\"midiSeconds\": " << summary.midiSeconds << ",\n"
+		<< "\t\"key\": " << JsonString(summary.keySign) << ",\n"
+		<< "\t\"bpm\": " << summary.bpm << ",\n"
+		<< "\t\"tempoChanges\": " << summary.nTempoChanges << ",\n"
+		<< "\t\"notes\": " << summary.nNotes << ",\n"
+		<< "\t\"processPeakResidentMB\": " << ((summary.processPeakRss + (1 << 19)) >> 20) << ",\n"
+		<< "\t\"stageSeconds\": {";
+	for (size_t i(0); i < summary.stageSeconds.size(); ++i) os << (i ? "," : "") << "\n\t\t"
+		<< JsonString(summary.stageSeconds.at(i).first) << ": " << summary.stageSeconds.at(i).second;
+	os << "\n\t}\n}\n";
+	return move(os.str());
+}
+
+string BatchRun::JsonString(const string& str)
+{
+	// UTF-8 bytes are kept as they are, only quotes, backslashes and control characters are escaped:
+	ostringstream os;
+	os << '"';
+	for (const auto c : str) switch (c)
+	{
+	case '"':	os << "\\\"";	break;
+	case '\\':	os << "\\\\";	break;
+	case '\n':	os << "\\n";	break;
+	case '\r':	os << "\\r";	break;
+	case '\t':	os << "\\t";	break;
+	default:
+		if (static_cast<unsigned char>(c) < 0x20)
+			os << "\\u" << hex << setw(4) << setfill('0') << static_cast<int>(c) << dec << setfill(' ');
+		else os << c;
+	}
+	os << '"';
+	return move(os.str());
+}
+
+int main(const int argc, char* argv[])
+{
+	return BatchRun::Main(argc, argv);
+}
\ No newline at end of file
@@ -0,0 +1,46 @@
+#pragma once
+#include "PianoToMidi/PianoToMidi.h"
+
+// Console front-end for the whole pipeline, without any windows or message boxes:
+// RNN models are loaded once, and every worker thread transcribes its own files with them,
+// each file is written as MIDI, and its summary (or error) as JSON, both next to each other in the output folder.
+// The same workers can instead keep running as a daemon, and take jobs from clients (see Daemon).
+// Arguments, paths and all the output are UTF-8, paths are converted by boost::filesystem (see Main).
+// Windows-only for now: there is only BatchRun.vcxproj, because the library is built by MSVC,
+// but the front-end itself needs just the standard library, boost and sockets (see Daemon.cpp):
+class BatchRun
+{
+	enum class MODE { BATCH, DAEMON, CLIENT };
+	struct Options
+	{
+		MODE mode;
+		size_t nWorkers, maxInFlight, windowSeconds;
+		boost::filesystem::path outDir, modelsDir;
+		std::string socketPath;
+		std::vector<boost::filesystem::path> mediaFiles;
+	};
+public:
+	struct Job { boost::filesystem::path mediaFile, midiFile, jsonFile; };
+
+	static int Main(int argc, const char* const argv[]);
+
+	// Summary JSON on success, otherwise the error JSON, and the error itself:
+	static std::string Transcribe(const Job& job, size_t windowSeconds,
+		const std::shared_ptr<const PianoToMidi::RnnModels>& models, std::string* error);
+
+	static std::string JsonString(const std::string& str);
+private:
+	static bool ParseArgs(int argc, const char* const argv[], Options* opts);
+	static std::vector<boost::filesystem::path> FindMedia(const boost::filesystem::path& folder);
+	static std::vector<Job> MakeJobs(const Options& opts);
+	static int RunBatch(const Options& opts, const std::shared_ptr<const PianoToMidi::RnnModels>& models);
+
+	static std::string SummaryJson(const Job& job, const PianoToMidi::Summary& summary);
+
+	static constexpr const char* usage = "Usage:\n"
+		"  BatchRun [-j workers] [-w window seconds] [-o output folder] [-m models folder] media files or folders...\n"
+		"  BatchRun -d [-j workers] [-q max jobs in flight] [-w window seconds] [-m models folder] [-s socket]\n"
+		"  BatchRun -c [-o output folder] [-s socket] media files or folders...";
+
+	BatchRun() = delete; // static members only
+};
\ No newline at end of file
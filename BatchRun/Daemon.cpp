@@ -0,0 +1,283 @@
+#include "stdafx.h"
+#include "Daemon.h"
+
+#ifdef _WIN32
+#	pragma warning(push, 3)
+#	include <WinSock2.h>
+#	include <afunix.h>
+#	pragma warning(pop)
+#else
+#	include <cerrno>
+#	include <sys/socket.h>
+#	include <sys/un.h>
+#	include <unistd.h>
+#endif
+
+using namespace std;
+using boost::filesystem::path;
+
+// The few calls, which are different between WinSock and POSIX sockets:
+#ifdef _WIN32
+constexpr SOCKET invalidSocket(INVALID_SOCKET);
+constexpr int shutSend(SD_SEND), shutBoth(SD_BOTH), sendFlags(0);
+int SocketError() { return WSAGetLastError(); }
+void CloseSocket(const SOCKET sock) { closesocket(sock); }
+
+class SocketLib
+{
+public:
+	SocketLib()
+	{
+		WSADATA wsaData;
+		isStarted_ = WSAStartup(MAKEWORD(2, 2), &wsaData) == 0;
+	}
+	~SocketLib() { if (isStarted_) WSACleanup(); }
+	bool IsStarted() const { return isStarted_; }
+private:
+	bool isStarted_;
+
+	SocketLib(const SocketLib&) = delete;
+	const SocketLib& operator=(const SocketLib&) = delete;
+};
+#else
+constexpr int invalidSocket(-1);
+constexpr int shutSend(SHUT_WR), shutBoth(SHUT_RDWR), sendFlags(MSG_NOSIGNAL); // a client gone is an error, not SIGPIPE
+int SocketError() { return errno; }
+void CloseSocket(const int sock) { close(sock); }
+
+class SocketLib { public: bool IsStarted() const { return true; } }; // nothing to start
+#endif
+
+struct Daemon::Connection
+{
+	const Socket sock;
+	mutex sendLock; // replies of different workers are never interleaved
+
+	explicit Connection(const Socket s) : sock(s) {}
+	~Connection() { CloseSocket(sock); }
+private:
+	Connection(const Connection&) = delete;
+	const Connection& operator=(const Connection&) = delete;
+};
+
+Daemon::Daemon(shared_ptr<const PianoToMidi::RnnModels> models, const size_t nWorkers,
+	const size_t maxInFlight, const size_t windowSeconds)
+	: socketLib_(make_unique<SocketLib>()), models_(move(models)), maxInFlight_(maxInFlight), windowSeconds_(windowSeconds), nInFlight_(0), isStopping_(false)
+{
+	assert(models_ and nWorkers and maxInFlight >= nWorkers and "Wrong daemon settings");
+	for (size_t i(0); i < nWorkers; ++i) workers_.emplace_back(&Daemon::Work, this);
+}
+Daemon::~Daemon()
+{
+	// Readers are woken up either by their sockets shut down, or while waiting for a free slot, and take no more jobs,
+	// then workers finish the jobs already queued:
+	{
+		const lock_guard<mutex> lock(lock_);
+		isStopping_ = true;
+		for (const auto& reader : readers_)
+		{
+			const auto conn(reader.conn.lock());
+			if (conn) shutdown(conn->sock, shutBoth);
+		}
+	}
+	slotFree_.notify_all();
+	jobReady_.notify_all();
+	for (auto& reader : readers_) reader.thread.join();
+	for (auto& worker : workers_) worker.join();
+}
+
+Daemon::Socket Daemon::Open(const string& socketPath, const bool isServer)
+{
+	sockaddr_un address{};
+	address.sun_family = AF_UNIX;
+	if (socketPath.size() >= sizeof address.sun_path)
+	{
+		cerr << "Socket path is too long: " << socketPath << endl;
+		return invalidSocket;
+	}
+	copy(socketPath.cbegin(), socketPath.cend(), address.sun_path);
+
+	const auto sock(socket(AF_UNIX, SOCK_STREAM, 0));
+	if (sock == invalidSocket)
+	{
+		cerr << "Could not create socket, error " << SocketError() << endl;
+		return invalidSocket;
+	}
+	if (isServer)
+	{
+		// Socket file of the previous daemon is left behind, if it was killed:
+		boost::system::error_code unusedError;
+		const auto unusedRemoved(boost::filesystem::remove(path(socketPath), unusedError));
+		if (bind(sock, reinterpret_cast<const sockaddr*>(&address), sizeof address) == 0
+			and listen(sock, SOMAXCONN) == 0) return sock;
+	}
+	else if (connect(sock, reinterpret_cast<const sockaddr*>(&address), sizeof address) == 0) return sock;
+
+	cerr << "Could not " << (isServer ? "listen on " : "connect to ") << socketPath << ", error " << SocketError() << endl;
+	CloseSocket(sock);
+	return invalidSocket;
+}
+
+int Daemon::Serve(const string& socketPath)
+{
+	if (not socketLib_->IsStarted()) return 1;
+	const auto listener(Open(socketPath, true));
+	if (listener == invalidSocket) return 1;
+	cout << "Listening on " << socketPath << ", " << workers_.size() << " workers, "
+		<< maxInFlight_ << " jobs in flight at most" << endl;
+
+	for (;;)
+	{
+		const auto client(accept(listener, nullptr, nullptr));
+		if (client == invalidSocket) break;
+		const auto conn(make_shared<Connection>(client));
+
+		// Readers of the connections already closed are joined here, the rest of them by the destructor:
+		const lock_guard<mutex> lock(lock_);
+		for (auto iter(readers_.begin()); iter != readers_.end();) if (iter->isDone)
+		{
+			iter->thread.join();
+			iter = readers_.erase(iter);
+		}
+		else ++iter;
+		readers_.push_back({ thread(), conn, false });
+		readers_.back().thread = thread(&Daemon::Read, this, conn, &readers_.back());
+	}
+	cerr << "Could not accept connection, error " << SocketError() << endl;
+	CloseSocket(listener);
+	return 1;
+}
+
+void Daemon::Read(const shared_ptr<Connection>& conn, Reader* reader)
+{
+	string buffer, line;
+	while (ReadLine(conn->sock, &buffer, &line))
+	{
+		if (line.empty()) continue;
+		const auto tab(line.find('\t'));
+		const path mediaFile(line.substr(0, tab));
+		const auto midiFile(tab == string::npos ? path(mediaFile).replace_extension(".mid") : path(line.substr(tab + 1)));
+
+		// Backpressure, the rest of the connection waits unread, until one of the jobs in flight is finished:
+		unique_lock<mutex> lock(lock_);
+		slotFree_.wait(lock, [this]() { return isStopping_ or nInFlight_ < maxInFlight_; });
+		if (isStopping_) break;
+		++nInFlight_;
+		queue_.push_back({ { mediaFile, midiFile, path() }, conn, chrono::steady_clock::now() });
+		lock.unlock();
+		jobReady_.notify_one();
+	}
+	if (buffer.size() > maxLine)
+	{
+		// The connection is closed, but with the reason, so that the client does not take it for a crash:
+		const lock_guard<mutex> lock(conn->sendLock);
+		const auto unusedIsSent(SendAll(conn->sock, "{\"ok\": false, \"error\": "
+			+ BatchRun::JsonString("Job line is longer than " + to_string(maxLine) + " bytes") + "}\n"));
+	}
+	const lock_guard<mutex> lock(lock_);
+	reader->isDone = true;
+}
+
+void Daemon::Work()
+{
+	for (;;)
+	{
+		Request request;
+		{
+			unique_lock<mutex> lock(lock_);
+			jobReady_.wait(lock, [this]() { return isStopping_ or not queue_.empty(); });
+			if (queue_.empty()) return;
+			request = move(queue_.front());
+			queue_.pop_front();
+		}
+		const auto started(chrono::steady_clock::now());
+		string error;
+		auto json(BatchRun::Transcribe(request.job, windowSeconds_, models_, &error));
+		const auto finished(chrono::steady_clock::now());
+
+		// Summary is indented over several lines, and strings have their tabs and line breaks escaped,
+		// so the reply becomes one line by just removing them:
+		json.erase(remove_if(json.begin(), json.end(), [](const char c) { return c == '\n' or c == '\t'; }), json.end());
+		ostringstream reply;
+		reply << fixed << setprecision(2) << "{\"ok\": " << (error.empty() ? "true" : "false")
+			<< ", \"queueSeconds\": " << chrono::duration<double>(started - request.received).count()
+			<< ", \"runSeconds\": " << chrono::duration<double>(finished - started).count()
+			<< ", \"result\": " << json << "}\n";
+		{
+			const lock_guard<mutex> lock(request.conn->sendLock);
+			const auto unusedIsSent(SendAll(request.conn->sock, reply.str())); // client may have gone, MIDI is written anyway
+		}
+		request.conn.reset();
+
+		{
+			const lock_guard<mutex> lock(lock_);
+			--nInFlight_;
+			cout << (error.empty() ? "Done:\t" : "Failed:\t") << request.job.mediaFile.string();
+			if (error.empty()) cout << " -> " << request.job.midiFile.string() << endl;
+			else cout << endl << '\t' << error << endl;
+		}
+		slotFree_.notify_one();
+	}
+}
+
+bool Daemon::ReadLine(const Socket sock, string* buffer, string* line)
+{
+	for (;;)
+	{
+		const auto eol(buffer->find('\n'));
+		if (eol != string::npos)
+		{
+			line->assign(*buffer, 0, eol);
+			buffer->erase(0, eol + 1);
+			if (not line->empty() and line->back() == '\r') line->pop_back();
+			return true;
+		}
+		if (buffer->size() > maxLine) return false;
+
+		array<char, 4'096> chunk;
+		const auto nRead(recv(sock, chunk.data(), static_cast<int>(chunk.size()), 0));
+		if (nRead <= 0) return false;
+		buffer->append(chunk.data(), static_cast<size_t>(nRead));
+	}
+}
+
+bool Daemon::SendAll(const Socket sock, const string& data)
+{
+	for (size_t done(0); done < data.size();)
+	{
+		const auto nSent(send(sock, data.data() + static_cast<ptrdiff_t>(done),
+			static_cast<int>(data.size() - done), sendFlags));
+		if (nSent <= 0) return false;
+		done += static_cast<size_t>(nSent);
+	}
+	return true;
+}
+
+int Daemon::Submit(const string& socketPath, const vector<BatchRun::Job>& jobs)
+{
+	const SocketLib socketLib;
+	if (not socketLib.IsStarted()) return 1;
+	const auto server(Open(socketPath, false));
+	if (server == invalidSocket) return 1;
+
+	// Jobs are sent on their own thread, because the daemon stops reading them, while too many are in flight,
+	// and it can only go on, after the replies are read:
+	thread sender([server, &jobs]()
+	{
+		for (const auto& job : jobs) if (not SendAll(server, job.mediaFile.string()
+			+ '\t' + job.midiFile.string() + '\n')) break;
+		shutdown(server, shutSend);
+	});
+	string buffer, line;
+	size_t nReplies(0), nFailed(0);
+	for (; nReplies < jobs.size() and ReadLine(server, &buffer, &line); ++nReplies)
+	{
+		if (line.compare(0, 12, "{\"ok\": true,") != 0) ++nFailed;
+		cout << line << endl;
+	}
+	sender.join();
+	CloseSocket(server);
+
+	cout << nReplies - nFailed << " of " << jobs.size() << " files transcribed" << endl;
+	return nFailed or nReplies < jobs.size() ? 1 : 0;
+}
\ No newline at end of file
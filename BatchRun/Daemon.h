@@ -0,0 +1,66 @@
+#pragma once
+#include "BatchRun.h"
+
+// Long-running process with one set of RNN models loaded for all the jobs,
+// they come over a Unix domain socket, one UTF-8 line per job: "media file<TAB>MIDI file" (or just the media file,
+// then MIDI is written next to it), and every job gets one JSON line back, in order of completion.
+// Jobs of all the connections share the workers, and no more than maxInFlight of them are queued or running,
+// beyond that the connections are not read, so that clients are held back by the socket itself:
+class Daemon
+{
+public:
+	Daemon(std::shared_ptr<const PianoToMidi::RnnModels> models, size_t nWorkers, size_t maxInFlight, size_t windowSeconds);
+	~Daemon();
+
+	// Returns only if the socket fails, then the daemon is to be destroyed, which stops and joins all its threads:
+	int Serve(const std::string& socketPath);
+	// Client side, sends all the jobs over one connection, and prints the replies, nonzero if any of them has failed:
+	static int Submit(const std::string& socketPath, const std::vector<BatchRun::Job>& jobs);
+private:
+	// Platform socket handle (SOCKET of WinSock, or file descriptor), sockets are only used in Daemon.cpp:
+#ifdef _WIN32
+	using Socket = uintptr_t;
+#else
+	using Socket = int;
+#endif
+	struct Connection;
+	struct Request
+	{
+		BatchRun::Job job;
+		std::shared_ptr<Connection> conn; // connection is closed after the last reply to it
+		std::chrono::steady_clock::time_point received;
+	};
+	struct Reader
+	{
+		std::thread thread;
+		std::weak_ptr<Connection> conn; // shut down, when the daemon stops
+		bool isDone;
+	};
+
+	void Read(const std::shared_ptr<Connection>& conn, Reader* reader);
+	void Work();
+
+	// False at the end of the stream, or if the line is too long (then the buffer is longer than maxLine):
+	static bool ReadLine(Socket sock, std::string* buffer, std::string* line);
+	static bool SendAll(Socket sock, const std::string& data);
+	static Socket Open(const std::string& socketPath, bool isServer);
+
+	static constexpr size_t maxLine = 0x1'0000;
+
+	// WinSock is started before, and cleaned up after, all the sockets of readers and workers:
+	const std::unique_ptr<class SocketLib> socketLib_;
+	const std::shared_ptr<const PianoToMidi::RnnModels> models_;
+	const size_t maxInFlight_, windowSeconds_;
+
+	std::mutex lock_; // guards everything below, and console output
+	std::condition_variable jobReady_, slotFree_;
+	std::deque<Request> queue_;
+	size_t nInFlight_;
+	bool isStopping_;
+	const uint8_t pad_[sizeof(intptr_t) - sizeof(bool)]{ 0 };
+	std::vector<std::thread> workers_;
+	std::list<Reader> readers_; // one per connection, list keeps the entry of every reader in place
+
+	Daemon(const Daemon&) = delete;
+	const Daemon& operator=(const Daemon&) = delete;
+};
\ No newline at end of file
@@ -0,0 +1,33 @@
+#pragma once
+
+// Only the standard library and boost, so that the front-end is the same on every platform,
+// sockets are included by Daemon.cpp only:
+#include <cassert>
+#pragma warning(push, 3)
+#pragma warning(disable:4244 4365 4514 4571 4599 4625 4626 4710 4711 4774 4820 5026 5027 5045)
+#	include <algorithm>
+#	include <array>
+#	include <atomic>
+#	include <cctype>
+#	include <chrono>
+#	include <condition_variable>
+#	include <cstdint>
+#	include <deque>
+#	include <iomanip>
+#	include <iostream>
+#	include <list>
+#	include <locale>
+#	include <memory>
+#	include <mutex>
+#	include <sstream>
+#	include <string>
+#	include <thread>
+#	include <vector>
+#pragma warning(pop)
+
+#pragma warning(push, 3)
+#pragma warning(disable:4242 4365 4514 4571 4619 4625 4626 4668 4710 4711 4774 4820 4826 4866 5026 5027 5031 26439 26495 28251)
+#	include <boost/filesystem/operations.hpp>
+#	include <boost/filesystem/fstream.hpp>
+#	include <boost/filesystem/detail/utf8_codecvt_facet.hpp>
+#pragma warning(pop)
\ No newline at end of file
@@ -4,6 +4,7 @@
 #include "MonoResampler.h"
 #include "FrameCodec.h"
 #include "Packet.h"
+#include "IntelCheckStatus.h"
 
 using namespace std;
 
@@ -20,6 +21,7 @@ struct FFmpegData
 	AVPacket* packet = nullptr;
 
 	vector<uint8_t> rawData;
+	function<void(const uint8_t**, int)> onFrame; // instead of rawData, if streaming
 };
 
 AudioLoader::AudioLoader(const char* fileName) : data_(make_unique<FFmpegData>())
@@ -110,6 +112,11 @@ int AudioLoader::DecodePacket() const
 			+ string(av_make_error_string(errStr, sizeof errStr / sizeof *errStr, response))).c_str());
 
 		// We now have a fully decoded audio frame
+		if (data_->onFrame)
+		{
+			data_->onFrame(const_cast<const uint8_t**>(data_->frame->extended_data), data_->frame->nb_samples);
+			continue;
+		}
 		if (data_->codecContext->channels == 2) assert (data_->frame->linesize[1] == 0);
 		else assert(data_->codecContext->channels == 1);
 		// There could be discarded samples for MP3, so use linesize instead of nb_samples * nBlockAlign
@@ -118,8 +125,9 @@ int AudioLoader::DecodePacket() const
 	}
 	return 0;
 }
-void AudioLoader::Decode() const
+void AudioLoader::OpenCodec() const
 {
+	assert(not data_->codecContext and "Audio is decoded only once");
 	data_->codecContext = avcodec_alloc_context3(data_->codec);
 	if (!data_->codecContext) throw FFmpegError("Could not allocate memory for codec context");
 	if (avcodec_parameters_to_context(data_->codecContext, data_->codecParams) < 0)
@@ -131,7 +139,9 @@ void AudioLoader::Decode() const
 	if (!data_->frame) throw FFmpegError("Could not allocate memory for frame");
 	data_->packet = av_packet_alloc();
 	if (!data_->packet) throw FFmpegError("Could not allocate memory for packet");
-
+}
+void AudioLoader::ReadPackets() const
+{
 	while (true)
 	{
 		Packet packet(data_->packet);
@@ -143,6 +153,51 @@ void AudioLoader::Decode() const
 	// Decode all the remaining frames in the buffer, until the end is reached
 	if (data_->codecContext->codec->capabilities & AV_CODEC_CAP_DELAY) while (DecodePacket() >= 0);
 }
+void AudioLoader::Decode() const
+{
+	OpenCodec();
+	ReadPackets();
+}
+
+void AudioLoader::DecodeStream(const int rate, const function<void(const float*, size_t)>& sink) const
+{
+	OpenCodec();
+	const auto srcRate(data_->codecContext->sample_rate);
+
+	// One resampler for all the frames, so that its filter continues from one frame to the next,
+	// and planar formats are read plane by plane, not as interleaved data:
+	unique_ptr<SwrContext, void(*)(SwrContext*)> context(swr_alloc_set_opts(nullptr,
+		av_get_default_channel_layout(1), AV_SAMPLE_FMT_FLT, rate,
+		av_get_default_channel_layout(data_->codecContext->channels), data_->codecContext->sample_fmt,
+		srcRate, 0, nullptr), [](SwrContext* ctx) { swr_free(&ctx); });
+	if (not context or swr_init(context.get()) < 0) throw FFmpegError("Could not initialize the resampling context");
+
+	vector<float> buffer;
+	data_->onFrame = [&context, &buffer, &sink, rate, srcRate](const uint8_t** samples, const int nSamples)
+	{
+		buffer.resize(static_cast<size_t>(av_rescale_rnd(swr_get_delay(context.get(), srcRate) + nSamples,
+			rate, srcRate, AV_ROUND_UP)));
+		auto dest(reinterpret_cast<uint8_t*>(buffer.data()));
+		const auto nResampled(swr_convert(context.get(), &dest, static_cast<int>(buffer.size()), samples, nSamples));
+		if (nResampled < 0) throw FFmpegError("Could not resample the audio");
+		if (nResampled) sink(buffer.data(), static_cast<size_t>(nResampled));
+	};
+	try
+	{
+		ReadPackets();
+		data_->onFrame(nullptr, 0); // the last samples still in the resampler
+	}
+	catch (...)
+	{
+		data_->onFrame = nullptr;
+		throw;
+	}
+	data_->onFrame = nullptr;
+
+	data_->codecContext->channels = 1;
+	data_->codecContext->sample_rate = rate;
+	data_->codecContext->sample_fmt = AV_SAMPLE_FMT_FLT;
+}
 
 void AudioLoader::MonoResample(int rate, const bool isFloatFmt) const
 {
@@ -159,4 +214,48 @@ void AudioLoader::MonoResample(int rate, const bool isFloatFmt) const
 	data_->codecContext->channels = 1;
 	data_->codecContext->sample_rate = rate;
 	data_->codecContext->sample_fmt = format;
+}
+
+size_t AudioLoader::TrimSilence(const int hopLen, const float marginSecs, const float topDb, const float aMin) const
+{
+	assert("Did you call Decode()?" && !data_->rawData.empty());
+	assert(data_->codecContext->sample_fmt == AV_SAMPLE_FMT_FLT and "Silence is trimmed only in float format");
+	assert(hopLen > 0 and marginSecs >= 0 and topDb >= 0 and "Wrong silence trimming parameters");
+
+	// Much cheaper than spectrum, and then all the transforms do not have to process the silence:
+	const auto samples(reinterpret_cast<const float*>(data_->rawData.data()));
+	const auto nSamples(GetNumSamples()), hop(static_cast<size_t>(hopLen)), nBlocks((nSamples + hop - 1) / hop);
+	vector<Ipp32f> mse(nBlocks); // Mean-square energy:
+	for (size_t i(0); i < nBlocks; ++i)
+	{
+		const auto len(static_cast<int>(min(hop, nSamples - i * hop)));
+		CHECK_IPP_RESULT(ippsDotProd_32f(samples + static_cast<ptrdiff_t>(i * hop),
+			samples + static_cast<ptrdiff_t>(i * hop), len, &mse.at(i)));
+		mse.at(i) /= len;
+	}
+	const auto range(LoudRange(mse.data(), nBlocks, nSamples, GetSampleRate(), hopLen, marginSecs, topDb, aMin));
+	const auto start(range.first), end(range.second);
+
+	const auto bytesPerSample(static_cast<ptrdiff_t>(GetBytesPerSample()));
+	data_->rawData.resize(static_cast<size_t>(static_cast<ptrdiff_t>(end) * bytesPerSample));
+	const auto unusedIter(data_->rawData.erase(data_->rawData.cbegin(),
+		data_->rawData.cbegin() + static_cast<ptrdiff_t>(start) * bytesPerSample));
+	return start;
+}
+
+pair<size_t, size_t> AudioLoader::LoudRange(const float* mse, const size_t nBlocks, const size_t nSamples,
+	const int rate, const int hopLen, const float marginSecs, const float topDb, const float aMin)
+{
+	assert(nBlocks and hopLen > 0 and marginSecs >= 0 and topDb >= 0 and "Wrong silence trimming parameters");
+
+	// Same threshold as SpecPostProc: topDb below the loudest block
+	const auto mseThresh(max(aMin, *max_element(mse, mse + nBlocks)) * pow(10.f, -topDb / 10));
+	const auto IsLoud([aMin, mseThresh](const float mse_i) { return max(aMin, mse_i) > mseThresh; });
+	const auto first(static_cast<size_t>(find_if(mse, mse + nBlocks, IsLoud) - mse)),
+		last(nBlocks - static_cast<size_t>(find_if(make_reverse_iterator(mse + nBlocks),
+			make_reverse_iterator(mse), IsLoud) - make_reverse_iterator(mse + nBlocks)));
+	if (first >= last) return make_pair(static_cast<size_t>(0), nSamples);
+
+	const auto hop(static_cast<size_t>(hopLen)), margin(static_cast<size_t>(ceil(marginSecs * rate / hopLen)));
+	return make_pair((first > margin ? first - margin : 0) * hop, min(nSamples, (last + margin) * hop));
 }
\ No newline at end of file
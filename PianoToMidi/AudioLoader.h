@@ -20,8 +20,21 @@ public:
 
 	// If not float, then S16 format for playing with DirectSound:
 	void MonoResample(int rate = 22'050, bool isFloatFormat = true) const;
+	// Float format only, cuts silence at both ends by mean-square energy of hop-length blocks,
+	// leaving margin (rounded up to whole hops) around the active region.
+	// Returns number of samples trimmed from the beginning, it is always multiple of hop length:
+	size_t TrimSilence(int hopLen = 512, float marginSeconds = 1, float topDb = 60, float aMin = 1e-10f) const;
+	// Samples [first, last) which TrimSilence keeps, from mean-square energy of nBlocks hop-length blocks:
+	static std::pair<size_t, size_t> LoudRange(const float* mse, size_t nBlocks, size_t nSamples, int sampleRate,
+		int hopLen = 512, float marginSeconds = 1, float topDb = 60, float aMin = 1e-10f);
+
+	// Instead of Decode and MonoResample, for recordings too long to be kept in memory:
+	// every decoded frame is resampled to mono float and passed to the sink, raw data stays empty:
+	void DecodeStream(int rate, const std::function<void(const float* samples, size_t nSamples)>& sink) const;
 private:
 	void FindAudioStream() const;
+	void OpenCodec() const;
+	void ReadPackets() const;
 	int DecodePacket() const;
 
 	const std::unique_ptr<struct FFmpegData> data_;
@@ -0,0 +1,161 @@
+#include "stdafx.h"
+#include "BeatTracker.h"
+
+using namespace std;
+
+BeatTracker::BeatTracker(const int rate, const int hopLen, const float bpm, const float tightness, const float scale)
+	: rate_(rate), hopLen_(hopLen),
+	period_(max(static_cast<size_t>(round(60. * rate / hopLen / bpm)), static_cast<size_t>(1))),
+	minLag_(max(static_cast<size_t>(round(period_ / 2.)), static_cast<size_t>(1))),
+	envFirst_(0), nReceived_(0), envMean_(0), envM2_(0), scale_(scale), scoreMax_(0),
+	cumFirst_(0), isFlushed_(false), isFirstBeat_(true)
+{
+	/* Ellis, Daniel PW. "Beat tracking by dynamic programming."
+	Journal of New Music Research 36.1 (2007): 51-60. http://labrosa.ee.columbia.edu/projects/beattrack/
+
+	Local score is onset envelope smoothed by a gaussian of one beat period on each side,
+	so it needs period frames of look-ahead. Cumulative score of a frame is its local score
+	plus the best cumulative score of a previous beat from 2 periods to half a period back,
+	penalized by the squared log-ratio of the interval to the period.
+	So every frame costs the same constant work whatever the audio duration,
+	and only back-links are kept for all the frames, never frames x lags */
+
+	assert(rate > 0 and hopLen > 0 and "Wrong onset envelope sample rate");
+	assert(bpm > 0 and "Starting tempo must be positive");
+	assert(scale >= 0 and "Onset envelope scale cannot be negative");
+
+	kernel_.resize(2 * period_ + 1);
+	for (size_t i(0); i < kernel_.size(); ++i) kernel_.at(i) = static_cast<float>(exp(-.5 * pow(
+		(static_cast<double>(i) - period_) * 32 / period_, 2)));
+
+	for (auto lag(2 * period_); lag >= minLag_; --lag) transWeights_.push_back(static_cast<float>(
+		-tightness * pow(log(static_cast<double>(lag) / period_), 2)));
+}
+BeatTracker::~BeatTracker() {} // C4710 Function not inlined
+
+float BeatTracker::At(const size_t frame) const
+{
+	assert(frame >= envFirst_ and "Onset envelope frame has already been forgotten");
+	return frame < nReceived_ ? env_.at(frame - envFirst_) : 0; // zero padding at the end
+}
+
+void BeatTracker::Push(const float* env, const size_t nFrames)
+{
+	assert(not isFlushed_ and "Pushing onset envelope after flush");
+	for (size_t i(0); i < nFrames; ++i)
+	{
+		env_.push_back(env[i]);
+		++nReceived_;
+		const auto delta(env[i] - envMean_);
+		envMean_ += delta / nReceived_;
+		envM2_ += delta * (env[i] - envMean_);
+
+		while (backLink_.size() + period_ < nReceived_) Score(backLink_.size());
+	}
+}
+
+void BeatTracker::Flush()
+{
+	if (isFlushed_) return;
+	isFlushed_ = true;
+	while (backLink_.size() < nReceived_) Score(backLink_.size());
+}
+
+void BeatTracker::Score(const size_t frame)
+{
+	// Local score, onset envelope is zero-padded at the beginning and at the end:
+	double localScore(0);
+	for (size_t i(frame < period_ ? period_ - frame : 0); i < kernel_.size(); ++i)
+		localScore += kernel_.at(i) * At(frame + i - period_);
+	const auto deviation(nReceived_ > 1 ? sqrt(envM2_ / (nReceived_ - 1)) : 0.);
+	const auto scale(scale_ != 0 ? scale_ : deviation);
+	const auto score(static_cast<float>(scale > 0 ? localScore / scale : localScore));
+	scoreMax_ = max(scoreMax_, score);
+
+	// Best previous beat, candidates before the beginning are skipped:
+	auto best(-numeric_limits<float>::infinity());
+	ptrdiff_t link(-1);
+	for (size_t j(0); j < transWeights_.size(); ++j)
+	{
+		const auto lag(2 * period_ - j);
+		if (lag > frame) continue;
+		const auto candidate(cumScore_.at(frame - lag - cumFirst_) + transWeights_.at(j));
+		if (candidate > best)
+		{
+			best = candidate;
+			link = static_cast<ptrdiff_t>(frame - lag);
+		}
+	}
+	const auto cumScore(link < 0 ? score : score + best);
+
+	// Special case the first onset, stop if the local score is small:
+	if (isFirstBeat_ and score < .01f * scoreMax_) link = -1;
+	else isFirstBeat_ = false;
+	backLink_.push_back(link);
+
+	// Local maximum of cumulative score at the previous frame (the last frame is checked in GetBeats):
+	if (frame >= 2 and cumScore_.back() > cumScore_.at(cumScore_.size() - 2) and cumScore_.back() >= cumScore)
+		cumPeaks_.emplace_back(frame - 1, cumScore_.back());
+	cumScore_.push_back(cumScore);
+	if (cumScore_.size() > 2 * period_ + 1)
+	{
+		cumScore_.pop_front();
+		++cumFirst_;
+	}
+
+	// Forget the envelope the next frame will not need:
+	for (; envFirst_ + period_ < frame + 1; ++envFirst_) env_.pop_front();
+}
+
+vector<size_t> BeatTracker::GetBeats() const
+{
+	vector<size_t> result;
+	if (backLink_.empty()) return result;
+
+	// Last beat is the last local maximum of cumulative score, above half of the median of all of them:
+	auto peaks(cumPeaks_);
+	if (backLink_.size() >= 2 and cumScore_.back() > cumScore_.at(cumScore_.size() - 2))
+		peaks.emplace_back(backLink_.size() - 1, cumScore_.back());
+	if (peaks.empty()) return result;
+	vector<float> values(peaks.size());
+	for (size_t i(0); i < peaks.size(); ++i) values.at(i) = peaks.at(i).second;
+	const auto median(values.begin() + static_cast<ptrdiff_t>(values.size() / 2));
+	nth_element(values.begin(), median, values.end());
+
+	auto last(peaks.crbegin());
+	while (last != peaks.crend() and last->second <= *median / 2) ++last;
+	if (last == peaks.crend()) return result;
+
+	for (auto beat(static_cast<ptrdiff_t>(last->first)); beat >= 0;
+		beat = backLink_.at(static_cast<size_t>(beat))) result.push_back(static_cast<size_t>(beat));
+	reverse(result.begin(), result.end());
+	return result;
+}
+
+vector<pair<double, double>> BeatTracker::TempoMap(const double tolerance, const size_t nSmooth) const
+{
+	assert(nSmooth > 0 and "Number of beat intervals for tempo must be positive");
+
+	vector<pair<double, double>> result;
+	const auto beats(GetBeats());
+	if (beats.size() < 2) return result;
+
+	vector<size_t> intervals(beats.size() - 1);
+	for (size_t i(0); i < intervals.size(); ++i) intervals.at(i) = beats.at(i + 1) - beats.at(i);
+
+	vector<size_t> window;
+	for (size_t i(0); i < intervals.size(); ++i)
+	{
+		window.assign(intervals.cbegin() + static_cast<ptrdiff_t>(i),
+			intervals.cbegin() + static_cast<ptrdiff_t>(min(i + nSmooth, intervals.size())));
+		const auto median(window.begin() + static_cast<ptrdiff_t>(window.size() / 2));
+		nth_element(window.begin(), median, window.end());
+		const auto bpm(60. * rate_ / hopLen_ / *median);
+
+		// The first tempo is from the very beginning, the following ones from their beats:
+		if (result.empty()) result.emplace_back(0, bpm);
+		else if (abs(bpm - result.back().second) > tolerance * result.back().second)
+			result.emplace_back(static_cast<double>(beats.at(i)) * hopLen_ / rate_, bpm);
+	}
+	return result;
+}
\ No newline at end of file
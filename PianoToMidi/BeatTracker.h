@@ -0,0 +1,48 @@
+#pragma once
+
+class BeatTracker
+{
+public:
+	// bpm - starting tempo estimate (for example from Tempogram), beats may drift from it,
+	// scale - onset envelope is divided by it, if zero, then by standard deviation of the values pushed so far:
+	explicit BeatTracker(int sampleRate, int hopLength, float bpm, float tightness = 100, float scale = 0);
+	~BeatTracker();
+
+	void Push(const float* onsetEnvelope, size_t nFrames);
+	void Flush(); // end of envelope, the last frames are scored with zero padding
+
+	// Best path through the frames scored so far, can still change near the end while streaming:
+	std::vector<size_t> GetBeats() const;
+	// Piecewise tempo (seconds since the first envelope frame, bpm), new tempo starts at a beat,
+	// where median of the next nSmooth beat intervals differs from the current tempo by more than tolerance:
+	std::vector<std::pair<double, double>> TempoMap(double tolerance = .05, size_t nSmooth = 4) const;
+
+#pragma warning(push)
+#pragma warning(disable:4514) // Unreferenced inline function has been removed
+	size_t GetLatency() const { return period_; } // envelope frames needed after the frame to score it
+#pragma warning(pop)
+private:
+	void Score(size_t frame);
+	float At(size_t frame) const;
+
+	const int rate_, hopLen_;
+	const size_t period_;
+	std::vector<float> kernel_, transWeights_; // local score window, and log-gaussian transition weights
+	size_t minLag_;
+
+	std::deque<float> env_; // envelope values still needed, the first one is frame envFirst_
+	size_t envFirst_, nReceived_;
+	double envMean_, envM2_; // running standard deviation (Welford)
+	const float scale_;
+	float scoreMax_;
+
+	std::deque<float> cumScore_; // last (2 * period + 1) cumulative scores, the first one is frame cumFirst_
+	size_t cumFirst_;
+	std::vector<ptrdiff_t> backLink_; // previous beat of every frame, or -1
+	std::vector<std::pair<size_t, float>> cumPeaks_; // local maximums of cumulative score
+	bool isFlushed_, isFirstBeat_;
+	const byte pad_[sizeof(intptr_t) - 2 * sizeof(bool)]{ 0 };
+
+	BeatTracker(const BeatTracker&) = delete;
+	const BeatTracker& operator=(const BeatTracker&) = delete;
+};
\ No newline at end of file
@@ -8,6 +8,7 @@
 #include "CqtBasis.h"
 #include "ShortTimeFourier.h"
 #include "CqtError.h"
+#include "ParallelFor.h"
 
 #include "IntelCheckStatus.h"
 
@@ -24,12 +25,12 @@ int Num2factors(int x)
 
 ConstantQ::ConstantQ(const shared_ptr<class AudioLoader>& audio, const size_t nBins,
 	const int octave, const float fMin, const int hopLen, const float filtScale, const NORM_TYPE norm,
-	const float sparsity, const CQT_WINDOW window, const bool toScale, const PAD_MODE pad)
+	const float sparsity, const CQT_WINDOW window, const bool toScale, const PAD_MODE pad, const bool concurrent)
 	: nBins_(nBins), fMin_(fMin), octave_(octave),
 	hopLen_(hopLen), hopLenReduced_(hopLen),
 	rateInitial_(audio->GetSampleRate()),
 	qBasis_(make_unique<CqtBasis>(octave, filtScale, norm, window)),
-	stft_(nullptr), audio_(audio), cqt_(make_shared<AlignedVector<float>>())
+	audio_(audio), cqt_(make_shared<AlignedVector<float>>())
 {
 	/* The recursive sub-sampling method described by
 	Schoerkhuber, Christian, and Anssi Klapuri
@@ -48,32 +49,59 @@ ConstantQ::ConstantQ(const shared_ptr<class AudioLoader>& audio, const size_t nB
 		and "CQT-frequencies are wrong");
 
 	auto nOctaves(static_cast<int>(ceil(Divide(nBins, octave))));
-	auto filterCutoff(fMaxOctave * (1 + .5 *WIN_BAND_WIDTH[
-		static_cast<int>(window)] / qBasis_->GetQfactor())); // Required resampling quality:
-	const bool isKaiserFast(filterCutoff < BW_FASTEST * rateInitial_ / 2);
-	EarlyDownsample(isKaiserFast, nOctaves, rateInitial_ / 2., filterCutoff);
+	const auto decimation(Decimation(rateInitial_, nOctaves, fMaxOctave, qBasis_->GetQfactor(), window, hopLen));
+	const auto isKaiserFast(decimation.first);
+	EarlyDownsample(decimation.second, nOctaves);
 
-	cqtResp_.reserve(nOctaves * qBasis_->GetFrequencies().size());
 	const auto nFilters(min(static_cast<size_t>(octave), nBins));
+	// Decimation chain is cheap, so it goes first, and signals of all octaves (top octave first) are collected,
+	// then responses of octaves do not depend on each other and can be calculated concurrently.
+	// Otherwise, each octave is calculated as soon as it is down-sampled, into the spectrum allocated
+	// for the top octave frames (down-sampling only loses frames), and trimmed to the shortest octave at the end:
+	vector<shared_ptr<const AlignedVector<float>>> signals;
+	vector<int> hops;
+	vector<float> scales;
+	size_t nOctavesAdded(0), nFrames(numeric_limits<size_t>::max());
+	const auto AddOctave([&](const CqtBasis& basis, const float scale, const bool isResampled)
+	{
+		if (not concurrent)
+		{
+			const auto nSamples(audio_->GetNumSamples());
+			nFrames = min(nFrames, nSamples / static_cast<size_t>(hopLenReduced_) + 1);
+			if (cqt_->empty()) cqt_->resize(nFrames * nBins);
+			Response(basis, reinterpret_cast<const float*>(audio_->GetRawData()), nSamples,
+				hopLenReduced_, scale, nOctavesAdded++, nFrames, pad);
+			return;
+		}
+		if (not isResampled and not signals.empty()) signals.push_back(signals.back()); // the same sample rate
+		else
+		{
+			const auto signal(reinterpret_cast<const float*>(audio_->GetRawData()));
+			signals.push_back(make_shared<const AlignedVector<float>>(signal,
+				signal + static_cast<ptrdiff_t>(audio_->GetNumSamples())));
+		}
+		hops.push_back(hopLenReduced_);
+		scales.push_back(scale);
+		++nOctavesAdded;
+	});
+
+	unique_ptr<CqtBasis> topBasis;
 #ifdef _DEBUG
 	size_t nFft(0);
 #endif
 	if (not isKaiserFast)
 	{
-		// Do the top octave before resampling to allow for fast resampling
-		qBasis_->CalcFilters(rateInitial_, fMinOctave, nFilters, sparsity);
+		// Do the top octave before resampling to allow for fast resampling,
+		// it has its own filters, because they are different from the rest of octaves:
+		topBasis = make_unique<CqtBasis>(octave, filtScale, norm, window);
+		topBasis->CalcFilters(rateInitial_, fMinOctave, nFilters, sparsity);
 #ifdef _DEBUG
-		nFft = qBasis_->GetFftFrameLen();
+		nFft = topBasis->GetFftFrameLen();
 #endif
-		stft_ = make_unique<ShortTimeFourier>(
-			qBasis_->GetFftFrameLen(), WIN_FUNC::RECT, pad);
-		Response();
+		AddOctave(*topBasis, 1, true);
 
 		fMinOctave /= 2;
-		fMaxOctave /= 2;
 		nOctaves -= 1;
-		filterCutoff = fMaxOctave * (1 + .5 * WIN_BAND_WIDTH[
-			static_cast<int>(window)] / qBasis_->GetQfactor());
 	}
 
 	if (Num2factors(hopLen) < nOctaves - 1)
@@ -90,31 +118,46 @@ ConstantQ::ConstantQ(const shared_ptr<class AudioLoader>& audio, const size_t nB
 	assert(nFft == 0 or nFft == qBasis_->GetFftFrameLen() and
 		"STFT frame length has changed, but it should not");
 #endif
-	if (not stft_) stft_ = make_unique<ShortTimeFourier>(
-		qBasis_->GetFftFrameLen(), WIN_FUNC::RECT, pad);
 
 	for (int i(0); i < nOctaves; ++i)
 	{
 		if (i) HalfDownSample(nOctaves); // except first time
-		Response();
+		// Filters are scaled by sqrt(2) per down-sample to compensate for it,
+		// and since response is linear, the magnitudes can be scaled instead of the shared filters:
+		if (i < nOctaves - 1 or not concurrent) AddOctave(*qBasis_, pow(sqrtf(2), static_cast<float>(i)), i > 0);
+		else // nothing resamples the audio after the bottom octave, so it is read in place:
+		{
+			signals.emplace_back();
+			hops.push_back(hopLenReduced_);
+			scales.push_back(pow(sqrtf(2), static_cast<float>(i)));
+			++nOctavesAdded;
+		}
 	}
+	assert(min(nOctavesAdded * nFilters, nBins) == nBins and "Wrong CQT-spectrum size");
 
-	assert(cqtResp_.size() == nBins and "Wrong CQT-spectrum size");
-	TrimErrors();
-	Scale(rateInitial_, toScale);
-
-	// Eventually, we can flatten the array, and get rid of temporary 2D-buffer:
-	cqt_->resize(cqtResp_.size() * cqtResp_.front().size());
-	AlignedVector<float>::iterator unusedIter;
-	for (size_t i(0); i < cqtResp_.size(); ++i) unusedIter = copy(cqtResp_.at(i).cbegin(),
-		cqtResp_.at(i).cend(), cqt_->begin() + static_cast<ptrdiff_t>(i * cqtResp_.at(i).size()));
-
-	MKL_Simatcopy('R', 'T', nBins, cqtResp_.front().size(),
-		1, cqt_->data(), cqtResp_.front().size(), nBins);
+	if (concurrent)
+	{
+		// Hop length is halved together with the sample rate after each down-sample,
+		// but FFmpeg strangely loses small number of frames after each down-sample
+		// And STFT right-end may get truncated several times,
+		// so cleanup framing errors at the right-boundary before the spectrum is allocated:
+		const auto NumSamples([this, &signals](const size_t i)
+		{ return signals.at(i) ? signals.at(i)->size() : audio_->GetNumSamples(); });
+		for (size_t i(0); i < signals.size(); ++i) nFrames = min(nFrames,
+			NumSamples(i) / static_cast<size_t>(hops.at(i)) + 1);
+		cqt_->resize(nFrames * nBins);
+
+		// Octaves write to disjoint columns of the spectrum, top octaves are the most expensive, so they start first:
+		ParallelFor(signals.size(), [&](const size_t i)
+		{
+			Response(i == 0 and topBasis ? *topBasis : *qBasis_, signals.at(i) ? signals.at(i)->data()
+				: reinterpret_cast<const float*>(audio_->GetRawData()), NumSamples(i), hops.at(i), scales.at(i), i, nFrames, pad);
+			signals.at(i).reset(); // will not need it anymore
+		});
+	}
+	else cqt_->resize(nFrames * nBins); // frames are rows, so the ones beyond the shortest octave are just cut off
 
-	stft_.reset(); // do not have to do it here, but will not need it anymore,
-	// so we can release it, because it is not const, and it is "unique" pointer
-	cqtResp_.clear();
+	Scale(rateInitial_, toScale);
 }
 
 ConstantQ::~ConstantQ() {}
@@ -122,12 +165,19 @@ ConstantQ::~ConstantQ() {}
 size_t ConstantQ::GetFftFrameLength() const { return qBasis_->GetFftFrameLen(); }
 
 
-void ConstantQ::EarlyDownsample(const bool isKaiserFast,
-	const int nOctaves, const double nyquist, const double cutOff)
+pair<bool, int> ConstantQ::Decimation(const int rate, const int nOctaves, const float fMaxOctave,
+	const float qFactor, const CQT_WINDOW window, const int hopLen)
+{
+	// Required resampling quality:
+	const auto nyquist(rate / 2.), cutOff(fMaxOctave * (1 + .5 * WIN_BAND_WIDTH[static_cast<int>(window)] / qFactor));
+	const bool isKaiserFast(cutOff < BW_FASTEST * nyquist);
+	if (not isKaiserFast) return { false, 0 };
+	return { true, min(max(0, static_cast<int>(ceil(log2(BW_FASTEST * nyquist / cutOff)) - 1) - 1),
+		max(0, Num2factors(hopLen) - nOctaves + 1)) };
+}
+
+void ConstantQ::EarlyDownsample(const int nDownSampleOps, const int nOctaves)
 {
-	if (not isKaiserFast) return;
-	const auto nDownSampleOps = min(max(0, static_cast<int>(ceil(log2(
-		BW_FASTEST * nyquist / cutOff)) - 1) - 1), max(0, Num2factors(hopLenReduced_) - nOctaves + 1));
 	if (nDownSampleOps == 0) return;
 
 	const auto downSampleFactor(static_cast<int>(pow(2, nDownSampleOps)));
@@ -160,59 +210,56 @@ void ConstantQ::HalfDownSample(const int nOctaves)
 	CHECK_IPP_RESULT(ippsMulC_32f_I(sqrtf(2), reinterpret_cast<Ipp32f*>(audio_->GetRawData()),
 		static_cast<int>(audio_->GetNumSamples())));
 
-	qBasis_->ScaleFilters(sqrtf(2)); // to compensate for downsampling
 	hopLenReduced_ /= 2;
 }
 
-void ConstantQ::Response()
+void ConstantQ::Response(const CqtBasis& basis, const float* signal, const size_t nSamples,
+	const int hopLen, const float scale, const size_t octave, const size_t nFrames, const PAD_MODE pad) const
 {
-	assert(cqtResp_.size() < nBins_ and "Wrong CQT-spectrum size");
-
-	stft_->RealForward(reinterpret_cast<float*>(
-		audio_->GetRawData()), audio_->GetNumSamples(), hopLenReduced_);
-	
-	// Filter response energy:
-	AlignedVector<MKL_Complex8> resp(qBasis_->GetLengths().size() * stft_->GetNumFrames());
-	qBasis_->RowMajorMultiply(reinterpret_cast<const MKL_Complex8*>(
-		stft_->GetSTFT().data()), resp.data(), static_cast<int>(stft_->GetNumFrames()));
-
-	// Unfortunately, cannot fill flattened array straight away,
-	// because we will know the final truncated number of frames
-	// only after all down-samples are finished, so, now append to the 2D-stack:
-	for (auto i(static_cast<ptrdiff_t>(qBasis_->GetLengths().size()) - 1); i > -1; --i)
+	const auto nFilters(basis.GetFrequencies().size());
+	assert(octave * nFilters < nBins_ and nFrames * nBins_ <= cqt_->size() and "Wrong CQT-spectrum size");
+	const auto nFft(basis.GetFftFrameLen());
+	assert(nSamples / static_cast<size_t>(hopLen) + 1 >= nFrames and "Octave has less frames than CQT-spectrum");
+
+	// Frames are centered, frame t covers padded samples [t * hop, t * hop + nFft)
+	// Only the frames overlapping padding are read from the padded copy of signal ends (one frame each),
+	// or the whole signal if it is that short, the rest of frames are read from the signal in place:
+	const auto isShort(nSamples <= 2 * nFft);
+	AlignedVector<float> ends((isShort ? nSamples : 2 * nFft) + nFft);
+	if (isShort) CHECK_IPP_RESULT(GetPadFunc(pad)(signal, nSamples, ends.data(), nFft));
+	else
 	{
-		cqtResp_.push_back(vector<float>(stft_->GetNumFrames()));
-		CHECK_IPP_RESULT(ippsMagnitude_32fc(reinterpret_cast<Ipp32fc*>(resp.data()
-			+ static_cast<ptrdiff_t>(i * cqtResp_.back().size())),
-			cqtResp_.back().data(), static_cast<int>(cqtResp_.back().size())));
-
-		if (cqtResp_.size() == nBins_) return; // Clip out bottom frequencies we do not want
+		// Both ends are enough for any padding mode, including wrapping:
+		AlignedVector<float> edges(signal, signal + static_cast<ptrdiff_t>(nFft));
+		edges.insert(edges.cend(), signal + static_cast<ptrdiff_t>(nSamples - nFft),
+			signal + static_cast<ptrdiff_t>(nSamples));
+		CHECK_IPP_RESULT(GetPadFunc(pad)(edges.data(), edges.size(), ends.data(), nFft));
 	}
-
-	assert(cqtResp_.size() < nBins_ and "Wrong CQT-spectrum size");
-}
-
-void ConstantQ::TrimErrors()
-{
-	// FFmpeg strangely loses small number of frames after each down-sample
-	// And STFT right-end may get truncated several times,
-	// so cleanup framing errors at the right-boundary:
-	const auto minCol(min_element(cqtResp_.cbegin(), cqtResp_.cend(),
-		[](const vector<float>& lhs, const vector<float>& rhs)
-	{ return lhs.size() < rhs.size(); })->size());
-	for (auto& resp : cqtResp_) resp.resize(minCol);
-
-	reverse(cqtResp_.begin(), cqtResp_.end());
+	const ShortTimeFourier stft(nFft, WIN_FUNC::RECT, pad);
+	const auto FrameStft([&](const size_t frame, complex<float>* dest)
+	{
+		const auto start(frame * static_cast<size_t>(hopLen));
+		if (isShort or start < nFft / 2) stft.FrameForward(ends.data() + static_cast<ptrdiff_t>(start), dest);
+		else if (start + nFft > nFft / 2 + nSamples) stft.FrameForward(ends.data()
+			+ static_cast<ptrdiff_t>(start + 2 * nFft - nSamples), dest);
+		else stft.FrameForward(signal + static_cast<ptrdiff_t>(start - nFft / 2), dest);
+	});
+
+	// Filter response energy written straight into the final columns of this octave,
+	// the top octave is the right-most, and clip out bottom frequencies we do not want:
+	const auto nValid(min(nFilters, nBins_ - octave * nFilters));
+	basis.MagnitudeResponse(FrameStft, nFrames, nFilters - nValid, scale,
+		cqt_->data() + static_cast<ptrdiff_t>(nBins_ - octave * nFilters - nValid), nBins_);
 }
 
 void ConstantQ::Scale(const int rateInit, const bool toScale)
 {
 	if (not toScale) return;
 
-	qBasis_->CalcLengths(rateInit, fMin_, cqtResp_.size());
+	qBasis_->CalcLengths(rateInit, fMin_, nBins_);
 	assert(qBasis_->GetLengths().size() == nBins_ and "Wrong number of CQT-lengths");
 	CHECK_IPP_RESULT(ippsSqrt_32f_I(qBasis_->GetLengths().data(), static_cast<int>(nBins_)));
 
-	for (size_t i(0); i < cqtResp_.size(); ++i) CHECK_IPP_RESULT(ippsDivC_32f_I(
-		qBasis_->GetLengths().at(i), cqtResp_.at(i).data(), static_cast<int>(cqtResp_.at(i).size())));
+	for (size_t i(0); i < cqt_->size(); i += nBins_) CHECK_IPP_RESULT(ippsDiv_32f_I(
+		qBasis_->GetLengths().data(), cqt_->data() + static_cast<ptrdiff_t>(i), static_cast<int>(nBins_)));
 }
\ No newline at end of file
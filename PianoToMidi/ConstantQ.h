@@ -8,10 +8,13 @@ public:
 	// Equivalent noise bandwidth (int FFT bins) of a window function:
 	static constexpr double WIN_BAND_WIDTH[] = { 1., 1.50018310546875, 1.3629455320350348 };
 
+	// Concurrent octaves need a copy of the signal for each of them (at most twice the audio in total),
+	// otherwise every octave is calculated right after its down-sample, reading the audio in place:
 	explicit ConstantQ(const std::shared_ptr<class AudioLoader>& audio,
 		size_t nBins = 88, int binsPerOctave = 12, float fMin = 27.5f, int hopLength = 512,
 		float filterScale = 1, NORM_TYPE norm = NORM_TYPE::L1, float sparsity = .01f,
-		CQT_WINDOW windowFunc = CQT_WINDOW::HANN, bool toScale = true, PAD_MODE pad = PAD_MODE::MIRROR);
+		CQT_WINDOW windowFunc = CQT_WINDOW::HANN, bool toScale = true, PAD_MODE pad = PAD_MODE::MIRROR,
+		bool concurrent = true);
 	~ConstantQ();
 #pragma warning(push)
 #pragma warning(disable:4514) // Unreferenced inline function has been removed
@@ -25,11 +28,17 @@ public:
 	int GetHopLength() const { return hopLen_; }
 	int GetSampleRate() const { return rateInitial_; }
 #pragma warning(pop)
+	// Decimation chain, shared with CqtStream: whether fast resampling is good enough for the top octave too
+	// (then all the octaves share the same filters, and each is down-sampled once more than the previous one),
+	// and how many times the audio is halved before all the octaves:
+	static std::pair<bool, int> Decimation(int sampleRate, int nOctaves, float fMaxOctave,
+		float qFactor, CQT_WINDOW windowFunc, int hopLength);
 private:
-	void EarlyDownsample(bool isKaiserFast, int nOctaves, double nyquist, double filterCutoff);
+	void EarlyDownsample(int nDownSampleOps, int nOctaves);
 	void HalfDownSample(int nOctaves);
-	void Response();
-	void TrimErrors();
+	// Octave zero is the top one:
+	void Response(const class CqtBasis& basis, const float* signal, size_t nSamples,
+		int hopLen, float scale, size_t octave, size_t nFrames, PAD_MODE pad) const;
 	void Scale(int sampleRateInitial, bool toScale);
 
 	const size_t nBins_;
@@ -40,10 +49,8 @@ private:
 	const byte pad_[4]{ 0 };
 #endif
 	const std::unique_ptr<class CqtBasis> qBasis_;
-	std::unique_ptr<class ShortTimeFourier> stft_;
 	std::shared_ptr<AudioLoader> audio_;
 
-	std::vector<std::vector<float>> cqtResp_;
 	std::shared_ptr<AlignedVector<float>> cqt_;
 #if not defined _WIN64 and defined NDEBUG
 	const byte pad_[4]{ 0 };
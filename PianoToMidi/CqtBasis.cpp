@@ -5,19 +5,34 @@
 #include "ConstantQ.h"
 #include "CqtBasis.h"
 
-#include "SparseMatrix.h"
 #include "IntelCheckStatus.h"
 #include "CqtError.h"
+#include "ParallelFor.h"
 
 using namespace std;
 #ifdef _DEBUG
 using boost::alignment::is_aligned;
 #endif
 
+struct CacheHeader
+{
+	// Increment the version whenever the filters calculation changes, old cache files will be ignored:
+	static constexpr uint32_t VERSION = 2;
+
+	char magic[8];
+	uint32_t version;
+	int32_t rate, octave, norm, window, hopLen;
+	float fMin, Q, sparsity;
+	uint32_t reserved;
+	uint64_t nBins, nFft, nValues;
+	// Followed by nBins band first bins, nBins band lengths (both uint64), and nValues complex band values
+};
+static_assert(sizeof(CacheHeader) == 72, "CQT-basis cache header should not have any padding");
+
 CqtBasis::CqtBasis(const int octave, const float scale,
 	const NORM_TYPE norm, const ConstantQ::CQT_WINDOW window)
 	: octave_(octave), Q_(scale / (pow(2.f, Divide(1, octave_)) - 1)),
-	NormFunc_(GetNormFuncComplex(norm)), window_(window),
+	NormFunc_(GetNormFuncComplex(norm)), norm_(norm), window_(window),
 	nFft_(0)
 {
 	assert(octave > 0 && "Bins per octave must be positive");
@@ -63,7 +78,6 @@ void CqtBasis::CalcFilters(const int rate, const float fMin,
 
 	// All filters will be center-padded up to the nearest integral power of 2:
 	nFft_ = static_cast<size_t>(pow(2.f, ceil(log2(lens_.front()))));
-	filts_.assign(nBins, vector<complex<float>>(nFft_, 0if));
 
 	// Eventually constant-Q filter basis will be transformed from time- to the frequency-domain
 	// and re-normalized to fft-window length:
@@ -72,9 +86,9 @@ void CqtBasis::CalcFilters(const int rate, const float fMin,
 		assert(hopLen > 0 && "Hop length must be positive");
 		nFft_ = max(nFft_, static_cast<size_t>(pow(2, 1 + ceil(log2(hopLen)))));
 	}
-	FFT fft(static_cast<int>(log2(nFft_)));
-	assert(nFft_ == static_cast<size_t>(fft.getSize()) &&
-		"Mistake in rounding to the nearest integral power of 2");
+	const auto cacheKey(CacheKey(rate, fMin, nBins, sparsity, hopLen));
+	if (LoadFilters(cacheKey)) return;
+	filts_.assign(nBins, vector<complex<float>>(nFft_, 0if));
 
 	IppStatus (*WinFunc)(Ipp32fc* srcDst, int len);
 	switch (window_)
@@ -88,31 +102,15 @@ void CqtBasis::CalcFilters(const int rate, const float fMin,
 	default: assert(!"Not all CQT windowing functions checked"); WinFunc = nullptr;
 	}
 
-	for (size_t i(0); i < filts_.size(); ++i)
+	// Filters do not depend on each other, but FFT-engine keeps its work buffer inside,
+	// so it is not shared, and its tables are cheap compared to the transform itself:
+	ParallelFor(filts_.size(), [&](const size_t i)
 	{
-		const auto offset((filts_.at(i).size() - static_cast<size_t>(lens_.at(i)) - 1) / 2);
-
-		/* Time-domain filter bank described by McVicar, Matthew
-		"A machine learning approach to automatic chord extraction."
-		Dissertation, University of Bristol. 2013.*/
-		for (size_t j(0); static_cast<float>(j) <= lens_.at(i); ++j) // length will be ceil(cqLen)
-			filts_.at(i).at(j + offset) = exp(Divide(floor(static_cast<float>(j) - lens_.at(i) / 2), rate)
-				* 2if * Multiply(M_PI, freqs_.at(i)));
-
-		const auto buff(reinterpret_cast<Ipp32fc*>(filts_.at(i).data()) + offset);
-		const auto size(static_cast<int>(ceil(lens_.at(i))));
-
-		// +1 if even to compensate for non-symmetry:
-		if (WinFunc) CHECK_IPP_RESULT(WinFunc(buff, size + 1 - static_cast<int>(lens_.at(i)) % 2));
-		
-		Ipp32f norm32(0);
-		if (NormFunc_) CHECK_IPP_RESULT(NormFunc_(buff, size, &norm32));
-		assert(norm32 && "Norm factor not calculated");
-		CHECK_IPP_RESULT(ippsMulC_32fc_I({ Divide(lens_.at(i), nFft_) / norm32, 0 }, buff, size));
-
-		fft.perform(filts_.at(i).data(), filts_.at(i).data(), false);
-		filts_.at(i).resize(nFft_ / 2 + 1); // Retain only the non-negative frequencies
-	}
+		const FFT fft(static_cast<int>(log2(nFft_)));
+		assert(nFft_ == static_cast<size_t>(fft.getSize()) &&
+			"Mistake in rounding to the nearest integral power of 2");
+		CalcFilter(i, rate, fft, WinFunc, sparsity);
+	});
 
 	assert(filts_.size() == freqs_.size() && freqs_.size() == lens_.size() &&
 		"Mistake in CQT-basis array sizes");
@@ -120,93 +118,255 @@ void CqtBasis::CalcFilters(const int rate, const float fMin,
 	for (const auto& f : filts_) assert(f.size() == nFft_ / 2 + 1 && "Wrong CQT-basis filter size");
 #endif
 
-	SparsifyRows(sparsity);
+	// Now, after all calculations are completed,
+	// it is convenient time to get rid of 2D-buffer:
+	ExtractBands();
+	filts_.clear();
+	SaveFilters(cacheKey);
+}
+
+void CqtBasis::CalcFilter(const size_t i, const int rate, const juce::dsp::FFT& fft,
+	IppStatus (*WinFunc)(Ipp32fc* srcDst, int len), const float sparsity)
+{
+	const auto offset((filts_.at(i).size() - static_cast<size_t>(lens_.at(i)) - 1) / 2);
+
+	/* Time-domain filter bank described by McVicar, Matthew
+	"A machine learning approach to automatic chord extraction."
+	Dissertation, University of Bristol. 2013.*/
+	for (size_t j(0); static_cast<float>(j) <= lens_.at(i); ++j) // length will be ceil(cqLen)
+		filts_.at(i).at(j + offset) = exp(Divide(floor(static_cast<float>(j) - lens_.at(i) / 2), rate)
+			* 2if * Multiply(M_PI, freqs_.at(i)));
+
+	const auto buff(reinterpret_cast<Ipp32fc*>(filts_.at(i).data()) + offset);
+	const auto size(static_cast<int>(ceil(lens_.at(i))));
+
+	// +1 if even to compensate for non-symmetry:
+	if (WinFunc) CHECK_IPP_RESULT(WinFunc(buff, size + 1 - static_cast<int>(lens_.at(i)) % 2));
+	
+	Ipp32f norm32(0);
+	if (NormFunc_) CHECK_IPP_RESULT(NormFunc_(buff, size, &norm32));
+	assert(norm32 && "Norm factor not calculated");
+	CHECK_IPP_RESULT(ippsMulC_32fc_I({ Divide(lens_.at(i), nFft_) / norm32, 0 }, buff, size));
+
+	fft.perform(filts_.at(i).data(), filts_.at(i).data(), false);
+	filts_.at(i).resize(nFft_ / 2 + 1); // Retain only the non-negative frequencies
+
+	SparsifyFilter(filts_.at(i), sparsity);
 }
 
 
-void CqtBasis::SparsifyRows(const float quantile)
+CacheHeader CqtBasis::CacheKey(const int rate, const float fMin,
+	const size_t nBins, const float sparsity, const int hopLen) const
 {
-	assert(0 <= quantile and quantile < 1 && "Quantile should be between zero and one");
-	size_t nNonZeros(0);
-	if (quantile > 0)
+	CacheHeader key{};
+	copy_n("CQTBASIS", sizeof key.magic, key.magic);
+	key.version = CacheHeader::VERSION;
+	key.rate = rate;
+	key.octave = octave_;
+	key.norm = static_cast<int32_t>(norm_);
+	key.window = static_cast<int32_t>(window_);
+	key.hopLen = hopLen;
+	key.fMin = fMin;
+	key.Q = Q_;
+	key.sparsity = sparsity;
+	key.nBins = nBins;
+	key.nFft = nFft_;
+	return key;
+}
+
+juce::File CqtBasis::CacheFile(const CacheHeader& key)
+{
+	using juce::File;
+
+	// The file name is FNV-1a hash of all parameters, and the header keeps the parameters themselves,
+	// so that hash collision could not return wrong filters:
+	auto hash(14'695'981'039'346'656'037ull);
+	const auto bytes(reinterpret_cast<const uint8_t*>(&key));
+	for (size_t i(0); i < offsetof(CacheHeader, nValues); ++i) hash = (hash ^ bytes[i]) * 1'099'511'628'211ull;
+
+	return File::getSpecialLocation(File::tempDirectory).getChildFile("PianoToMidi").getChildFile(
+		"CqtBasis_" + juce::String::toHexString(static_cast<juce::int64>(hash)) + ".bin");
+}
+
+bool CqtBasis::LoadFilters(const CacheHeader& key)
+{
+	const auto file(CacheFile(key));
+	if (not file.existsAsFile()) return false;
+	juce::MemoryMappedFile mapped(file, juce::MemoryMappedFile::readOnly);
+	if (not mapped.getData() or mapped.getSize() < sizeof key) return false;
+
+	const auto header(static_cast<const CacheHeader*>(mapped.getData()));
+	if (memcmp(header, &key, offsetof(CacheHeader, nValues))) return false;
+	const auto nBins(static_cast<size_t>(header->nBins)), nValues(static_cast<size_t>(header->nValues));
+	if (mapped.getSize() != sizeof key + 2 * nBins * sizeof(uint64_t) + nValues * sizeof(complex<float>))
+		return false; // probably, truncated by crash while writing
+
+	const auto bands(reinterpret_cast<const uint64_t*>(header + 1));
+	const auto values(reinterpret_cast<const complex<float>*>(bands + static_cast<ptrdiff_t>(2 * nBins)));
+	bandFirst_.assign(bands, bands + static_cast<ptrdiff_t>(nBins));
+	bandLen_.assign(bands + static_cast<ptrdiff_t>(nBins), bands + static_cast<ptrdiff_t>(2 * nBins));
+	bandPos_.resize(nBins);
+	size_t pos(0);
+	for (size_t i(0); i < nBins; ++i)
 	{
-		/* Quantile will zero-out 99.9% of values, then sparse mult will make sense
-		Especially if num filters = not 88, but one octave (12 * nBins),
-		then multiplication time will be milliseconds compared to seconds.
+		bandPos_.at(i) = pos;
+		pos += bandLen_.at(i);
+	}
+	if (pos != nValues) return false;
+	bandVals_.assign(values, values + static_cast<ptrdiff_t>(nValues));
+	return true;
+}
 
-		Otherwise, dense matrix multiplication will be faster*/
+void CqtBasis::SaveFilters(const CacheHeader& key) const
+{
+	// Cache is only an optimization, so if it cannot be written, filters are just calculated next time again:
+	const auto file(CacheFile(key));
+	if (file.getParentDirectory().createDirectory().failed()) return;
 
-		IppSizeL radixSize;
-		CHECK_IPP_RESULT(ippsSortRadixGetBufferSize_L(static_cast<IppSizeL>(
-			filts_.front().size()), ipp32f, &radixSize));
-		AlignedVector<Ipp8u> radixBuff(static_cast<size_t>(radixSize));
+	// Write into temporary file first and then replace, so that other instances never see half-written cache:
+	juce::TemporaryFile temp(file);
+	{
+		juce::FileOutputStream stream(temp.getFile());
+		if (stream.failedToOpen()) return;
+
+		auto header(key);
+		header.nValues = bandVals_.size();
+		auto isWritten(stream.write(&header, sizeof header));
+		for (const auto& band : { cref(bandFirst_), cref(bandLen_) }) for (const auto x : band.get())
+			isWritten = isWritten and stream.writeInt64(static_cast<juce::int64>(x));
+		isWritten = isWritten and stream.write(bandVals_.data(), bandVals_.size() * sizeof bandVals_.front());
+		stream.flush();
+		if (not isWritten or stream.getStatus().failed()) return;
+	}
+	const auto unusedResult(temp.overwriteTargetFileWithTemporary());
+}
+
+
+void CqtBasis::SparsifyFilter(vector<complex<float>>& filt, const float quantile)
+{
+	assert(0 <= quantile and quantile < 1 && "Quantile should be between zero and one");
+	if (quantile == 0) return;
+
+	/* Quantile will zero-out 99.9% of values, leaving narrow band around each filter's center frequency,
+	Especially if num filters = not 88, but one octave (12 * nBins),
+	then multiplication time will be milliseconds compared to seconds.*/
+
+	AlignedVector<Ipp32f> mags(filt.size());
+	CHECK_IPP_RESULT(ippsMagnitude_32fc(reinterpret_cast<Ipp32fc*>(filt.data()),
+		mags.data(), static_cast<int>(filt.size())));
+
+	Ipp32f l1Norm;
+	CHECK_IPP_RESULT(ippsSum_32f(mags.data(), static_cast<int>(mags.size()), &l1Norm, ippAlgHintFast));
+	const auto target(static_cast<double>(quantile) * l1Norm);
+	if (target <= 0) return;
+
+	/* Threshold is the smallest magnitude kept: in ascending order it is the element with the largest index m,
+	such that sum of all smaller elements is still less than quantile * L1-norm.
+	Instead of full sort, the range [lo, hi) containing m is halved by selection,
+	keeping the sum of the lo smallest elements, which is always less than the target */
+	auto magsSel(mags);
+	size_t lo(0), hi(magsSel.size());
+	double sumLo(0);
+	while (hi - lo > 1)
+	{
+		const auto mid(lo + (hi - lo) / 2);
+		const auto first(magsSel.begin() + static_cast<ptrdiff_t>(lo)),
+			middle(magsSel.begin() + static_cast<ptrdiff_t>(mid));
+		nth_element(first, middle, magsSel.begin() + static_cast<ptrdiff_t>(hi));
 
-		for (auto& filt : filts_)
+		const auto sumMid(accumulate(first, middle, sumLo));
+		if (sumMid < target)
 		{
-			AlignedVector<Ipp32f> mags(filt.size());
-			CHECK_IPP_RESULT(ippsMagnitude_32fc(reinterpret_cast<Ipp32fc*>(filt.data()),
-				mags.data(), static_cast<int>(filt.size())));
-
-			auto magsSort(mags);
-			CHECK_IPP_RESULT(ippsSortRadixAscend_32f_I_L(magsSort.data(),
-				static_cast<int>(magsSort.size()), radixBuff.data()));
-
-			Ipp32f l1Norm;
-			CHECK_IPP_RESULT(ippsSum_32f(magsSort.data(),
-				static_cast<int>(magsSort.size()), &l1Norm, ippAlgHintFast));
-
-			auto threshold(quantile * l1Norm);
-			for (size_t i(0); i < magsSort.size(); ++i)
-			{
-				l1Norm -= magsSort.at(magsSort.size() - i - 1);
-				if (l1Norm < threshold)
-				{
-					threshold = magsSort.at(magsSort.size() - i - 1);
-					break;
-				}
-			}
-			for (size_t i(0); i < filt.size(); ++i)
-				if (mags.at(i) < threshold) filt.at(i) = 0;
-				else ++nNonZeros;
+			lo = mid;
+			sumLo = sumMid;
 		}
+		else hi = mid;
 	}
+	const auto threshold(magsSel.at(lo)); // range of one element is exactly the lo-th smallest
 
-	// Now, after all calculations are completed,
-	// it is convenient time to flatten the array and get rid of 2D-buffer:
-	filtsFlat_.assign(filts_.size() * filts_.front().size(), 0);
-	AlignedVector<complex<float>>::iterator unusedIter;
-	for (size_t j(0); j < filts_.size(); ++j) unusedIter = copy(filts_.at(j).cbegin(),
-		filts_.at(j).cend(), filtsFlat_.begin() + static_cast<ptrdiff_t>(j * filts_.at(j).size()));
+	for (size_t i(0); i < filt.size(); ++i) if (mags.at(i) < threshold) filt.at(i) = 0;
+}
 
-	assert(is_aligned(filtsFlat_.data(), 64) && "CQT-basis filters: flat array is not aligned");
+void CqtBasis::ExtractBands()
+{
+	/* After sparsification the only non-zeros left are the main lobe of each filter,
+	so instead of generic CSR-matrix the filter is stored as a single band [first, first + length).
+	With zero sparsity the band just covers the whole filter, and it is still the dense case */
+
+	bandFirst_.resize(filts_.size());
+	bandLen_.resize(filts_.size());
+	bandPos_.resize(filts_.size());
+	size_t nValues(0);
+	for (size_t i(0); i < filts_.size(); ++i)
+	{
+		const auto isNonZero([](const complex<float>& x) { return x != 0if; });
+		const auto first(find_if(filts_.at(i).cbegin(), filts_.at(i).cend(), isNonZero));
+		const auto last(find_if(filts_.at(i).crbegin(), filts_.at(i).crend(), isNonZero).base());
+		assert(first < last and "CQT-basis filter has been zeroed out completely");
+
+		bandFirst_.at(i) = static_cast<size_t>(first - filts_.at(i).cbegin());
+		bandLen_.at(i) = static_cast<size_t>(last - first);
+		bandPos_.at(i) = nValues;
+		nValues += bandLen_.at(i);
+	}
 
-	if (quantile > 0) csr_ = make_unique<SparseMatrix>(reinterpret_cast<MKL_Complex8*>(filtsFlat_.data()),
-		static_cast<int>(filts_.size()), static_cast<int>(filts_.front().size()), nNonZeros);
+	bandVals_.resize(nValues);
+	AlignedVector<complex<float>>::iterator unusedIter;
+	for (size_t i(0); i < filts_.size(); ++i) unusedIter = copy_n(filts_.at(i).cbegin()
+		+ static_cast<ptrdiff_t>(bandFirst_.at(i)), bandLen_.at(i),
+		bandVals_.begin() + static_cast<ptrdiff_t>(bandPos_.at(i)));
 
-	filts_.clear();
+	assert(is_aligned(bandVals_.data(), 64) && "CQT-basis filters: band values are not aligned");
 }
 
 
-void CqtBasis::ScaleFilters(const float scale)
+void CqtBasis::MagnitudeResponse(const complex<float>* stft, const size_t nFrames,
+	const size_t firstFilter, const float scale, float* dest, const size_t destStride) const
 {
-	if (csr_) csr_->Scale(scale);
-	else CHECK_IPP_RESULT(ippsMulC_32fc_I({ scale, 0 },
-		reinterpret_cast<Ipp32fc*>(filtsFlat_.data()), static_cast<int>(filtsFlat_.size())));
+	assert(nFrames > 0 && "Number of STFT-frames must be positive");
+	assert(firstFilter < bandLen_.size() && "First CQT-filter is out of range");
+	assert(destStride >= bandLen_.size() - firstFilter && "Destination rows overlap");
+
+	// Tile of frames (nFft / 2 + 1 complex each) stays in cache, while each band runs over all frames of the tile,
+	// and the complex response of the tile is immediately reduced to magnitudes:
+	const auto nFreqs(nFft_ / 2 + 1), nFilters(bandLen_.size() - firstFilter);
+	AlignedVector<Ipp32fc> tile(tileLen * nFilters);
+
+	for (size_t t(0); t < nFrames; t += tileLen)
+	{
+		const auto nTile(min(tileLen, nFrames - t));
+		for (size_t j(0); j < nFilters; ++j)
+		{
+			const auto band(reinterpret_cast<const Ipp32fc*>(bandVals_.data())
+				+ static_cast<ptrdiff_t>(bandPos_.at(firstFilter + j)));
+			const auto bandLen(static_cast<int>(bandLen_.at(firstFilter + j)));
+			const auto frames(reinterpret_cast<const Ipp32fc*>(stft)
+				+ static_cast<ptrdiff_t>(t * nFreqs + bandFirst_.at(firstFilter + j)));
+
+			for (size_t f(0); f < nTile; ++f) CHECK_IPP_RESULT(ippsDotProd_32fc(
+				frames + static_cast<ptrdiff_t>(f * nFreqs), band, bandLen,
+				tile.data() + static_cast<ptrdiff_t>(f * nFilters + j)));
+		}
+		for (size_t f(0); f < nTile; ++f)
+		{
+			const auto row(dest + static_cast<ptrdiff_t>((t + f) * destStride));
+			CHECK_IPP_RESULT(ippsMagnitude_32fc(tile.data() + static_cast<ptrdiff_t>(f * nFilters),
+				row, static_cast<int>(nFilters)));
+			if (scale != 1) CHECK_IPP_RESULT(ippsMulC_32f_I(scale, row, static_cast<int>(nFilters)));
+		}
+	}
 }
 
-void CqtBasis::RowMajorMultiply(const MKL_Complex8* src,
-	MKL_Complex8* dest, const int nDestCols) const
+void CqtBasis::MagnitudeResponse(const function<void(size_t, complex<float>*)>& FrameStft, const size_t nFrames,
+	const size_t firstFilter, const float scale, float* dest, const size_t destStride) const
 {
-	assert(nDestCols > 0 && "Number of columns in destination matrix must be positive");
-	assert(filtsFlat_.size() == freqs_.size() * (nFft_ / 2 + 1));
-
-	// If there are 99.9% of zeros, then mult time may be milliseconds instead of seconds:
-	if (csr_) csr_->RowMajorMultiply(src, dest, nDestCols);
-	else // If not, dense multiplication would be quicker:
+	const auto nFreqs(nFft_ / 2 + 1);
+	AlignedVector<complex<float>> frames(tileLen * nFreqs);
+	for (size_t t(0); t < nFrames; t += tileLen)
 	{
-		complex<float> alpha(1), beta(0);
-		cblas_cgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, static_cast<int>(freqs_.size()),
-			nDestCols, static_cast<int>(nFft_ / 2 + 1), &alpha, filtsFlat_.data(),
-			static_cast<int>(nFft_ / 2 + 1), src, nDestCols, &beta, dest, nDestCols);
+		const auto nTile(min(tileLen, nFrames - t));
+		for (size_t f(0); f < nTile; ++f) FrameStft(t + f, frames.data() + static_cast<ptrdiff_t>(f * nFreqs));
+		MagnitudeResponse(frames.data(), nTile, firstFilter, scale,
+			dest + static_cast<ptrdiff_t>(t * destStride), destStride);
 	}
 }
\ No newline at end of file
@@ -11,8 +11,15 @@ public:
 	void CalcLengths(int sampleRate, float fMin, size_t nBins);
 	void CalcFilters(int sampleRate, float fMin, size_t nBins, float sparsity, int hopLen = 0);
 
-	void ScaleFilters(float scale);
-	void RowMajorMultiply(const MKL_Complex8* source, MKL_Complex8* dest, int nDestColumns) const;
+	// dest (nFrames x nBins - firstFilter, rows are destStride apart) = scale * |frame-major STFT
+	//		(nFrames x nFft / 2 + 1) * transposed filters starting from firstFilter|
+	void MagnitudeResponse(const std::complex<float>* stft, size_t nFrames,
+		size_t firstFilter, float scale, float* dest, size_t destStride) const;
+	// The same, but FrameStft(frame, dest) writes each frame straight into a tile of tileLen frames
+	// right before its response, so that the whole STFT is never kept:
+	void MagnitudeResponse(const std::function<void(size_t frame, std::complex<float>* dest)>& FrameStft,
+		size_t nFrames, size_t firstFilter, float scale, float* dest, size_t destStride) const;
+	static constexpr size_t tileLen = 32; // frames
 #pragma warning(push)
 #pragma warning(disable:4514) // Unreferenced inline function has been removed
 	float GetQfactor() const { return Q_; }
@@ -21,23 +28,31 @@ public:
 	size_t GetFftFrameLen() const { return nFft_; }
 #pragma warning(pop)
 private:
-	void SparsifyRows(float quantile);
+	void CalcFilter(size_t index, int sampleRate, const juce::dsp::FFT& fft,
+		IppStatus (*WinFunc)(Ipp32fc* srcDst, int len), float sparsity);
+	static void SparsifyFilter(std::vector<std::complex<float>>& filt, float quantile);
+	void ExtractBands();
+
+	// Filter bank depends only on its parameters, so it is cached on disk between runs:
+	struct CacheHeader CacheKey(int sampleRate, float fMin, size_t nBins, float sparsity, int hopLen) const;
+	static juce::File CacheFile(const CacheHeader& key);
+	bool LoadFilters(const CacheHeader& key);
+	void SaveFilters(const CacheHeader& key) const;
 
 	const int octave_;
 	const float Q_;
 	std::function<IppStatus(const Ipp32fc* src, int len, Ipp32f* normVal)> NormFunc_;
+	const NORM_TYPE norm_;
 	const ConstantQ::CQT_WINDOW window_;
-#ifdef _WIN64
-	const byte pad_[4]{ 0 };
-#endif
 
 	std::vector<float> freqs_, lens_;
 
 	std::vector<std::vector<std::complex<float>>> filts_;
-	AlignedVector<std::complex<float>> filtsFlat_;
+	// Non-zeros of each frequency-domain filter form one contiguous band,
+	// so only the band is stored: first frequency bin, length, and offset into the common values array:
+	std::vector<size_t> bandFirst_, bandLen_, bandPos_;
+	AlignedVector<std::complex<float>> bandVals_;
 	size_t nFft_;
-
-	std::unique_ptr<class SparseMatrix> csr_;
 #ifndef _WIN64
 	const byte pad_[4]{ 0 };
 #endif
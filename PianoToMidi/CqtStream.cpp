@@ -0,0 +1,368 @@
+#include "stdafx.h"
+
+#include "AlignedVector.h"
+#include "EnumFuncs.h"
+#include "ConstantQ.h"
+#include "CqtStream.h"
+
+#include "CqtBasis.h"
+#include "ShortTimeFourier.h"
+#include "CqtError.h"
+
+#include "IntelCheckStatus.h"
+
+using namespace std;
+
+struct CqtLevel
+{
+	SwrContext* decimator = nullptr; // to the next level with half sample rate
+	int rate = 0, hop = 0;
+
+	AlignedVector<float> buffer; // padded signal, the first sample is padded sample number bufferStart
+	size_t bufferStart = 0, nRaw = 0; // number of samples received at this level
+	bool isPadded = false; // left-end
+};
+
+struct CqtOctave
+{
+	const CqtBasis* basis = nullptr;
+	float scale = 1;
+	size_t level = 0, firstFilter = 0, firstBin = 0, nextFrame = 0;
+};
+
+#pragma warning(push)
+#pragma warning(disable:4820) // bytes padding added after data member
+struct CqtStreamData
+{
+	size_t nBins = 0, nFft = 0;
+	int hopLen = 0, rate = 0, earlyFactor = 1;
+	SwrContext* early = nullptr; // early down-sample of the input to the top level
+	bool toScale = true, isFlushed = false;
+	PAD_MODE pad = PAD_MODE::MIRROR;
+
+	unique_ptr<CqtBasis> topBasis, basis;
+	unique_ptr<ShortTimeFourier> stft;
+	vector<CqtLevel> levels;
+	vector<CqtOctave> octaves;
+	vector<float> lens; // square roots of filter lengths, for scaling
+
+	AlignedVector<complex<float>> frames; // STFT of the new frames of one octave
+	AlignedVector<float> pending; // frames not read yet, some octaves may still be missing
+	size_t pendingFirst = 0, pendingRead = 0; // frame numbers of the first pending row, and of the first one not read yet
+
+	~CqtStreamData()
+	{
+		swr_free(&early);
+		for (auto& level : levels) swr_free(&level.decimator);
+	}
+};
+#pragma warning(pop)
+
+CqtStream::CqtStream(const int rate, const size_t nBins, const int octave, const float fMin,
+	const int hopLen, const float filtScale, const NORM_TYPE norm, const float sparsity,
+	const ConstantQ::CQT_WINDOW window, const bool toScale, const PAD_MODE pad)
+	: data_(make_unique<CqtStreamData>())
+{
+	/* Same recursive sub-sampling as in ConstantQ, with the same decimation chain:
+	if fast resampling is good enough for the top octave, the input may be down-sampled early,
+	then all the octaves share the same filters, and each following octave is down-sampled by 2,
+	otherwise the top octave is at the initial sample rate with its own filters,
+	the next one is also at the initial rate, and each following octave is down-sampled by 2.
+	But every level keeps its own resampler state and overlap buffer,
+	so that frames can be calculated as soon as enough samples come for all octaves */
+
+	assert(pad == PAD_MODE::MIRROR or pad == PAD_MODE::CONSTANT and
+		"Streaming CQT supports only mirror and constant padding");
+	data_->nBins = nBins;
+	data_->hopLen = hopLen;
+	data_->rate = rate;
+	data_->toScale = toScale;
+	data_->pad = pad;
+
+	data_->basis = make_unique<CqtBasis>(octave, filtScale, norm, window);
+	data_->basis->CalcFrequencies(rate, fMin, nBins);
+	const auto fMinOctave(*(data_->basis->GetFrequencies().cend() - octave));
+	const auto nOctaves(static_cast<size_t>(ceil(Divide(nBins, octave)))),
+		nFilters(min(static_cast<size_t>(octave), nBins));
+	const auto decimation(ConstantQ::Decimation(rate, static_cast<int>(nOctaves),
+		data_->basis->GetFrequencies().back(), data_->basis->GetQfactor(), window, hopLen));
+	const auto isKaiserFast(decimation.first);
+	data_->earlyFactor = 1 << decimation.second;
+	const auto topRate(rate / data_->earlyFactor), topHop(hopLen / data_->earlyFactor);
+	if (toScale)
+	{
+		data_->basis->CalcLengths(topRate, fMin, nBins);
+		data_->lens = data_->basis->GetLengths();
+		CHECK_IPP_RESULT(ippsSqrt_32f_I(data_->lens.data(), static_cast<int>(nBins)));
+	}
+
+	const auto nLevels(isKaiserFast ? nOctaves : max(nOctaves, static_cast<size_t>(2)) - 1);
+	if (topHop <= 0 or topHop % (1 << (nLevels - 1)))
+	{
+		ostringstream os;
+		os << "Hop length must be a positive integer, long enough, multiple of 2^" << nLevels - 1
+			<< " = " << (1 << (nLevels - 1)) << " to support the bottom octave of "
+			<< nOctaves << "-octave CQT";
+		throw CqtError(os.str().c_str());
+	}
+
+	if (not isKaiserFast)
+	{
+		data_->topBasis = make_unique<CqtBasis>(octave, filtScale, norm, window);
+		data_->topBasis->CalcFilters(topRate, fMinOctave, nFilters, sparsity);
+		data_->nFft = data_->topBasis->GetFftFrameLen();
+	}
+	if (isKaiserFast or nOctaves > 1)
+	{
+		data_->basis->CalcFilters(topRate, isKaiserFast ? fMinOctave : fMinOctave / 2, nFilters, sparsity);
+		assert(data_->nFft == 0 or data_->nFft == data_->basis->GetFftFrameLen() and
+			"STFT frame length has changed, but it should not");
+		data_->nFft = data_->basis->GetFftFrameLen();
+	}
+	data_->stft = make_unique<ShortTimeFourier>(data_->nFft, WIN_FUNC::RECT, pad);
+
+	if (data_->earlyFactor > 1)
+	{
+		data_->early = swr_alloc_set_opts(nullptr, av_get_default_channel_layout(1),
+			AV_SAMPLE_FMT_FLT, topRate, av_get_default_channel_layout(1),
+			AV_SAMPLE_FMT_FLT, rate, 0, nullptr);
+		if (not data_->early or swr_init(data_->early) < 0)
+			throw CqtError("Could not initialize the resampling context");
+	}
+	data_->levels.resize(nLevels);
+	for (size_t j(0); j < nLevels; ++j)
+	{
+		auto& level(data_->levels.at(j));
+		level.rate = j ? data_->levels.at(j - 1).rate / 2 : topRate;
+		level.hop = topHop >> j;
+		if (j + 1 == nLevels) break;
+
+		level.decimator = swr_alloc_set_opts(nullptr, av_get_default_channel_layout(1),
+			AV_SAMPLE_FMT_FLT, level.rate / 2, av_get_default_channel_layout(1),
+			AV_SAMPLE_FMT_FLT, level.rate, 0, nullptr);
+		if (not level.decimator or swr_init(level.decimator) < 0)
+			throw CqtError("Could not initialize the resampling context");
+	}
+
+	data_->octaves.resize(nOctaves);
+	for (size_t i(0); i < nOctaves; ++i)
+	{
+		auto& oct(data_->octaves.at(i));
+		oct.basis = isKaiserFast or i ? data_->basis.get() : data_->topBasis.get();
+		oct.level = isKaiserFast ? i : max(i, static_cast<size_t>(1)) - 1;
+		// Filters compensation for down-sampling, applied to magnitudes:
+		oct.scale = pow(sqrtf(2), static_cast<float>(oct.level));
+
+		// Top octave is the right-most, and clip out bottom frequencies we do not want:
+		const auto nValid(min(nFilters, nBins - i * nFilters));
+		oct.firstFilter = nFilters - nValid;
+		oct.firstBin = nBins - i * nFilters - nValid;
+	}
+}
+
+CqtStream::~CqtStream() {}
+
+size_t CqtStream::GetNumBins() const { return data_->nBins; }
+int CqtStream::GetHopLength() const { return data_->hopLen; }
+int CqtStream::GetSampleRate() const { return data_->rate; }
+size_t CqtStream::GetFftFrameLength() const { return data_->nFft; }
+size_t CqtStream::GetLatency() const
+{
+	return (data_->nFft / 2 << (data_->levels.size() - 1)) * static_cast<size_t>(data_->earlyFactor);
+}
+
+
+void CqtStream::Push(const float* samples, const size_t nSamples)
+{
+	assert(not data_->isFlushed and "Streaming CQT has already been flushed");
+	if (data_->early) EarlyDownsample(samples, nSamples);
+	else Append(0, samples, nSamples);
+	CalcFrames();
+	Trim();
+}
+
+void CqtStream::Flush()
+{
+	if (data_->isFlushed) return;
+
+	// Resamplers still hold some delayed samples, each drained level goes down to the next one:
+	if (data_->early) EarlyDownsample(nullptr, 0);
+	for (size_t j(0); j + 1 < data_->levels.size(); ++j) Decimate(j, nullptr, 0);
+	for (size_t j(0); j < data_->levels.size(); ++j) PadRight(j);
+	data_->isFlushed = true;
+
+	CalcFrames();
+	Trim();
+}
+
+size_t CqtStream::GetNumFrames() const
+{
+	auto result(numeric_limits<size_t>::max());
+	for (const auto& oct : data_->octaves) result = min(result, oct.nextFrame - data_->pendingRead);
+	return result;
+}
+
+size_t CqtStream::Read(float* dest, const size_t maxFrames)
+{
+	const auto nFrames(min(maxFrames, GetNumFrames()));
+	if (nFrames == 0) return 0;
+
+	const auto nValues(nFrames * data_->nBins);
+	const auto src(data_->pending.data() + static_cast<ptrdiff_t>((data_->pendingRead - data_->pendingFirst) * data_->nBins));
+	if (data_->toScale) for (size_t i(0); i < nValues; i += data_->nBins) CHECK_IPP_RESULT(ippsDiv_32f_I(
+		data_->lens.data(), src + static_cast<ptrdiff_t>(i), static_cast<int>(data_->nBins)));
+	CHECK_IPP_RESULT(ippsCopy_32f(src, dest, static_cast<int>(nValues)));
+	data_->pendingRead += nFrames;
+
+	// Read rows are dropped from the front only when they are at least a half of the pending rows,
+	// so that every value is moved a constant number of times on average, not on every read:
+	const auto nDone((data_->pendingRead - data_->pendingFirst) * data_->nBins);
+	if (2 * nDone >= data_->pending.size())
+	{
+		data_->pending.erase(data_->pending.cbegin(), data_->pending.cbegin() + static_cast<ptrdiff_t>(nDone));
+		data_->pendingFirst = data_->pendingRead;
+	}
+	return nFrames;
+}
+
+
+void CqtStream::Append(const size_t j, const float* samples, const size_t nSamples)
+{
+	if (nSamples == 0) return;
+
+	auto& level(data_->levels.at(j));
+	const auto unusedIter(level.buffer.insert(level.buffer.cend(), samples, samples + nSamples));
+	level.nRaw += nSamples;
+	// Mirror padding needs half frame + 1 samples at the beginning:
+	if (not level.isPadded and level.nRaw > data_->nFft / 2) PadLeft(j);
+
+	if (j + 1 < data_->levels.size()) Decimate(j, samples, nSamples);
+}
+
+static vector<float> Resample(SwrContext* resampler, const int rateFrom, const int rateTo,
+	const float* samples, const size_t nSamples)
+{
+	vector<float> result(static_cast<size_t>(av_rescale_rnd(swr_get_delay(resampler, rateFrom)
+		+ static_cast<int64_t>(nSamples), rateTo, rateFrom, AV_ROUND_UP)));
+	auto dest(reinterpret_cast<uint8_t*>(result.data()));
+	auto src(reinterpret_cast<const uint8_t*>(samples));
+	const auto nResult(swr_convert(resampler, &dest, static_cast<int>(result.size()),
+		samples ? &src : nullptr, static_cast<int>(nSamples)));
+	if (nResult < 0) throw CqtError("Could not down-sample the audio");
+	result.resize(static_cast<size_t>(nResult));
+	return result;
+}
+
+void CqtStream::EarlyDownsample(const float* samples, const size_t nSamples)
+{
+	// Same as ConstantQ::EarlyDownsample, without energy scaling:
+	const auto result(Resample(data_->early, data_->rate, data_->levels.front().rate, samples, nSamples));
+	Append(0, result.data(), result.size());
+}
+
+void CqtStream::Decimate(const size_t j, const float* samples, const size_t nSamples)
+{
+	const auto& level(data_->levels.at(j));
+	assert(level.decimator and "The bottom level is not down-sampled");
+
+	auto result(Resample(level.decimator, level.rate, level.rate / 2, samples, nSamples));
+	if (result.empty()) return;
+
+	// Scale the resampled signal, so that it has approximately equal total energy:
+	CHECK_IPP_RESULT(ippsMulC_32f_I(sqrtf(2), result.data(), static_cast<int>(result.size())));
+	Append(j + 1, result.data(), result.size());
+}
+
+void CqtStream::PadLeft(const size_t j)
+{
+	auto& level(data_->levels.at(j));
+	assert(not level.isPadded and level.bufferStart == 0 and "Left-end is already padded");
+	const auto half(data_->nFft / 2);
+
+	// Pad half frame, so that frames are centered, zeros if constant:
+	AlignedVector<float> padded(half + level.buffer.size());
+	AlignedVector<float>::iterator unusedIter;
+	if (data_->pad == PAD_MODE::MIRROR) unusedIter = reverse_copy(level.buffer.cbegin() + 1,
+		level.buffer.cbegin() + 1 + static_cast<ptrdiff_t>(half), padded.begin());
+	unusedIter = copy(level.buffer.cbegin(), level.buffer.cend(), padded.begin() + static_cast<ptrdiff_t>(half));
+
+	level.buffer.swap(padded);
+	level.isPadded = true;
+}
+
+void CqtStream::PadRight(const size_t j)
+{
+	auto& level(data_->levels.at(j));
+	const auto half(data_->nFft / 2);
+	if (not level.isPadded)
+	{
+		if (data_->pad == PAD_MODE::MIRROR)
+		{
+			ostringstream os;
+			os << "Input audio signal length = " << level.nRaw << " at sample rate " << level.rate
+				<< " is too short for mirror padding of " << half << " samples";
+			throw CqtError(os.str().c_str());
+		}
+		PadLeft(j);
+	}
+
+	// Trim always keeps the last half frame + 1 samples for this:
+	const auto nOld(level.buffer.size());
+	level.buffer.resize(nOld + half);
+	if (data_->pad == PAD_MODE::MIRROR) for (size_t k(1); k <= half; ++k)
+		level.buffer.at(nOld - 1 + k) = level.buffer.at(nOld - 1 - k);
+}
+
+void CqtStream::CalcFrames()
+{
+	const auto nFreqs(data_->nFft / 2 + 1);
+	for (auto& oct : data_->octaves)
+	{
+		const auto& level(data_->levels.at(oct.level));
+		if (not level.isPadded) continue;
+
+		// Frames are centered, frame t covers padded samples [t * hop, t * hop + nFft),
+		// after the right-end is padded, it gives the same number of frames as ShortTimeFourier:
+		const auto paddedEnd(level.bufferStart + level.buffer.size());
+		if (paddedEnd < data_->nFft) continue;
+		const auto nTotal((paddedEnd - data_->nFft) / static_cast<size_t>(level.hop) + 1);
+		if (nTotal <= oct.nextFrame) continue;
+		const auto nFrames(nTotal - oct.nextFrame);
+
+		data_->frames.resize(nFrames * nFreqs);
+		for (size_t i(0); i < nFrames; ++i) data_->stft->FrameForward(level.buffer.data()
+			+ static_cast<ptrdiff_t>((oct.nextFrame + i) * static_cast<size_t>(level.hop) - level.bufferStart),
+			data_->frames.data() + static_cast<ptrdiff_t>(i * nFreqs));
+
+		const auto nRows(oct.nextFrame + nFrames - data_->pendingFirst);
+		if (data_->pending.size() < nRows * data_->nBins) data_->pending.resize(nRows * data_->nBins);
+		oct.basis->MagnitudeResponse(data_->frames.data(), nFrames, oct.firstFilter, oct.scale,
+			data_->pending.data() + static_cast<ptrdiff_t>((oct.nextFrame - data_->pendingFirst)
+				* data_->nBins + oct.firstBin), data_->nBins);
+		oct.nextFrame += nFrames;
+	}
+}
+
+void CqtStream::Trim()
+{
+	for (size_t j(0); j < data_->levels.size(); ++j)
+	{
+		auto& level(data_->levels.at(j));
+		if (not level.isPadded) continue;
+
+		// Keep from the next frame of the slowest octave at this level,
+		// and the last half frame + 1 samples for mirror padding of the right-end:
+		auto keepFrom(level.bufferStart + level.buffer.size());
+		for (const auto& oct : data_->octaves) if (oct.level == j)
+			keepFrom = min(keepFrom, oct.nextFrame * static_cast<size_t>(level.hop));
+		if (not data_->isFlushed) keepFrom = min(keepFrom,
+			level.bufferStart + level.buffer.size() - data_->nFft / 2 - 1);
+		// Samples before keepFrom are dropped only when they are at least a half of the buffer,
+		// so that every sample is moved a constant number of times on average, not on every push:
+		if (keepFrom <= level.bufferStart or 2 * (keepFrom - level.bufferStart) < level.buffer.size()) continue;
+
+		level.buffer.erase(level.buffer.cbegin(), level.buffer.cbegin()
+			+ static_cast<ptrdiff_t>(keepFrom - level.bufferStart));
+		level.bufferStart = keepFrom;
+	}
+}
\ No newline at end of file
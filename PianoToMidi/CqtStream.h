@@ -0,0 +1,39 @@
+#pragma once
+
+class CqtStream
+{
+public:
+	// Same parameters as ConstantQ, but audio comes in blocks of mono float samples:
+	explicit CqtStream(int sampleRate, size_t nBins = 88, int binsPerOctave = 12, float fMin = 27.5f,
+		int hopLength = 512, float filterScale = 1, NORM_TYPE norm = NORM_TYPE::L1, float sparsity = .01f,
+		ConstantQ::CQT_WINDOW windowFunc = ConstantQ::CQT_WINDOW::HANN, bool toScale = true,
+		PAD_MODE pad = PAD_MODE::MIRROR);
+	~CqtStream();
+
+	void Push(const float* samples, size_t nSamples);
+	void Flush(); // end of input, right-end gets padded, and the remaining frames become ready
+
+	size_t GetNumFrames() const; // ready to be read
+	// Frame-major, nBins per frame, returns number of frames actually read:
+	size_t Read(float* dest, size_t maxFrames);
+
+	size_t GetNumBins() const;
+	int GetHopLength() const;
+	int GetSampleRate() const;
+	size_t GetFftFrameLength() const; // same for all octaves
+	// Input samples needed by the bottom octave before its frame is ready, not counting resampler delay:
+	size_t GetLatency() const;
+private:
+	void EarlyDownsample(const float* samples, size_t nSamples); // nullptr to drain the resampler
+	void Append(size_t level, const float* samples, size_t nSamples);
+	void Decimate(size_t level, const float* samples, size_t nSamples); // nullptr to drain the resampler
+	void PadLeft(size_t level);
+	void PadRight(size_t level);
+	void CalcFrames();
+	void Trim();
+
+	const std::unique_ptr<struct CqtStreamData> data_;
+
+	CqtStream(const CqtStream&) = delete;
+	const CqtStream& operator=(const CqtStream&) = delete;
+};
\ No newline at end of file
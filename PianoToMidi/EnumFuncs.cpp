@@ -96,6 +96,43 @@ void Aggregate(const float* src, const int srcNrows, const int rowStart,
 		CHECK_IPP_RESULT(AggrFunc(src + i * srcWidth, srcWidth, dest + i));
 }
 
+void AggregateColumns(const float* src, const int srcNrows,
+	const int srcWidth, float* dest, const AGGREGATE aggr)
+{
+	assert(srcNrows > 0 and srcWidth > 0 and "Nothing to aggregate");
+
+	switch (aggr)
+	{
+	case AGGREGATE::MEAN:
+		CHECK_IPP_RESULT(ippsZero_32f(dest, srcWidth));
+		for (ptrdiff_t i(0); i < srcNrows; ++i)
+			CHECK_IPP_RESULT(ippsAdd_32f_I(src + i * srcWidth, dest, srcWidth));
+		CHECK_IPP_RESULT(ippsDivC_32f_I(static_cast<Ipp32f>(srcNrows), dest, srcWidth));	break;
+	case AGGREGATE::MIN:
+		CHECK_IPP_RESULT(ippsCopy_32f(src, dest, srcWidth));
+		for (ptrdiff_t i(1); i < srcNrows; ++i) CHECK_IPP_RESULT(ippsMinEvery_32f_I(
+			src + i * srcWidth, dest, static_cast<Ipp32u>(srcWidth)));						break;
+	case AGGREGATE::MAX:
+		CHECK_IPP_RESULT(ippsCopy_32f(src, dest, srcWidth));
+		for (ptrdiff_t i(1); i < srcNrows; ++i) CHECK_IPP_RESULT(ippsMaxEvery_32f_I(
+			src + i * srcWidth, dest, static_cast<Ipp32u>(srcWidth)));						break;
+	case AGGREGATE::MEDIAN:
+	{
+		vector<float> column(static_cast<size_t>(srcNrows));
+		for (ptrdiff_t j(0); j < srcWidth; ++j)
+		{
+			for (size_t i(0); i < column.size(); ++i)
+				column.at(i) = src[static_cast<ptrdiff_t>(i) * srcWidth + j];
+			nth_element(column.begin(), column.begin()
+				+ static_cast<ptrdiff_t>(column.size() / 2), column.end());
+			dest[j] = column.size() % 2 ? column.at(column.size() / 2) : (column.at(column.size() / 2)
+				+ *max_element(column.cbegin(), column.cbegin() + static_cast<ptrdiff_t>(column.size() / 2))) / 2;
+		}
+	} break;
+	default: assert(!"Not all aggregating functions checked");
+	}
+}
+
 function<IppStatus(const Ipp32f* src, int len, Ipp32f* normVal)>
 GetNormFuncReal(const NORM_TYPE norm)
 {
@@ -11,6 +11,9 @@ GetPadFunc(PAD_MODE);
 enum class AGGREGATE { MEAN, MIN, MAX, MEDIAN };
 void Aggregate(const float* source, int srcNumRows, int rowStart,
 	int srcNumColumns, float* dest, AGGREGATE);
+// Same, but aggregates every column across all rows (for frame-major matrices):
+void AggregateColumns(const float* source, int srcNumRows,
+	int srcNumColumns, float* dest, AGGREGATE);
 
 enum class NORM_TYPE { NONE, L1, L2, INF };
 std::function<IppStatus(const Ipp32f* src, int len, Ipp32f* normVal)>
@@ -8,8 +8,9 @@ public:
 		float marginHarm = 1.f, float marginPerc = 1.f);
 	~HarmonicPercussive();
 
+	// Differences of percussive frames are copied in tiles of that many frames, zero means all the frames at once:
 	void OnsetEnvelope(size_t lag = 1, int maxSize = 1, bool toDetrend = false,
-		bool toCenter = true, AGGREGATE aggregate = AGGREGATE::MEAN);
+		bool toCenter = true, AGGREGATE aggregate = AGGREGATE::MEAN, size_t framesTile = 0);
 	void OnsetPeaksDetect(bool toBackTrack = false);
 
 	void Chromagram(bool baseC = true, // the first chroma bin will start at 'C', else at 'A'
@@ -19,6 +20,23 @@ public:
 	void ChromaSum(bool onsetsOnly = true);
 	std::string KeySignature() const;
 
+	// Percussive spectrum is only needed for onset envelope, and harmonic one for chromagram:
+	void ReleasePercussive();
+	void ReleaseHarmonic();
+	size_t GetNumBytes() const; // all the buffers together
+
+	// Shared with HpssStream, which calculates the same things frame by frame:
+	static float SoftMask(float x, float ref, float power, bool splitZeros);
+	// Every CQT bin goes to exactly one chroma bin with its own weight (window value, or one):
+	struct ChromaFolding { std::vector<size_t> index; std::vector<float> weight; size_t nChroma; };
+	static ChromaFolding ChromaBins(size_t nBins, int binsPerOctave, float fMin,
+		bool baseC, size_t nChroma, WIN_FUNC window);
+	// Frame-major decibel spectrum --> frame-major chromagram of amplitudes 10^((Sdb - dbSub) / 20),
+	// thresholded and normalized frame by frame in the same pass:
+	static void FoldChroma(const float* harmDb, size_t nFrames, const ChromaFolding& folding,
+		float dbSub, NORM_TYPE norm, float threshold, float* chroma);
+	static std::string KeySignature(const std::vector<float>& chromaSum, bool baseC);
+
 #pragma warning(push)
 #pragma warning(disable:4514) // Unreferenced inline function has been removed
 	const std::vector<float>& GetHarmonic() const { return harm_; }
@@ -26,8 +44,6 @@ public:
 	const std::vector<size_t>& GetOnsetPeaks() const { return percPeaks_; }
 #pragma warning(pop)
 private:
-	void OnsetBackTrack();
-
 	std::shared_ptr<ConstantQ> cqt_;
 
 	std::vector<float> harm_, perc_, percEnv_;
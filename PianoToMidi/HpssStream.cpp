@@ -0,0 +1,223 @@
+#include "stdafx.h"
+
+#include "AlignedVector.h"
+#include "EnumFuncs.h"
+#include "HarmonicPercussive.h"
+#include "HpssStream.h"
+
+#include "SlidingMedian.h"
+#include "IntelCheckStatus.h"
+
+using namespace std;
+
+#pragma warning(push)
+#pragma warning(disable:4820) // bytes padding added after data member
+struct HpssStreamData
+{
+	size_t nBins = 0, nChroma = 0, kernelHarm = 0, half = 0, nRing = 0, lag = 1;
+	int kernelPerc = 0, maxSize = 1;
+	float power = 2, margHarm = 1, margPerc = 1, threshold = 0;
+	bool splitZeros = true, toDetrend = false, baseC = true, isFlushed = false;
+	AGGREGATE aggr = AGGREGATE::MEAN;
+	NORM_TYPE norm = NORM_TYPE::INF;
+
+	// Ring buffers of the last input frames and their medians across bins, frame i is in row i % nRing:
+	vector<float> spectr, percMed;
+	vector<float> window; // one bin along time, for the median
+	size_t nReceived = 0, nCalculated = 0;
+
+	vector<float> percPrev, percDiff; // last lag percussive frames (ring), and difference to the reference
+	deque<float> envDelay; // onset shift
+	float detrendX = 0, detrendY = 0; // IIR filter state
+
+	HarmonicPercussive::ChromaFolding folding;
+	vector<float> chrSum;
+
+	vector<float> harm, perc, env, chroma; // frames not read yet, after nRead frames already read
+	size_t nRead = 0;
+};
+#pragma warning(pop)
+
+HpssStream::HpssStream(const size_t nBins, const int binsPerOctave, const float fMin,
+	const int kernelHarm, const int kernelPerc, const float power,
+	const float margHarm, const float margPerc,
+	const size_t lag, const int maxSize, const bool toDetrend, const size_t onsetShift,
+	const AGGREGATE aggr, const bool baseC, const NORM_TYPE norm,
+	const float threshold, const size_t nChroma, const WIN_FUNC window)
+	: data_(make_unique<HpssStreamData>())
+{
+	/* Percussive median is across bins, so it is ready as soon as its frame comes.
+	Harmonic median is along time, so it needs kernelHarm / 2 frames of look-ahead,
+	and the left-end is mirrored from the frames already received.
+	Everything else (masks, onset envelope, chroma) is frame by frame,
+	so all the outputs come with the same fixed delay */
+
+	assert(kernelHarm > 0 and kernelPerc > 0 and "Median filter kernel size must be positive");
+	assert(min(margHarm, margPerc) >= 1 and "HPSS margins must be >= 1.0, a typical range is [1...10]");
+	assert(lag >= 1 and "Onset strength envelope lag must be >= 1");
+	assert(maxSize >= 1 and "Onset strength envelope max size must be >= 1");
+
+	data_->nBins = nBins;
+	data_->nChroma = nChroma;
+	data_->kernelHarm = static_cast<size_t>(kernelHarm);
+	data_->half = data_->kernelHarm / 2;
+	data_->nRing = 2 * data_->half + 1; // even kernel reads one more frame to the left
+	data_->kernelPerc = kernelPerc;
+	data_->power = power;
+	data_->margHarm = margHarm;
+	data_->margPerc = margPerc;
+	data_->splitZeros = margHarm == 1 and margPerc == 1;
+
+	data_->lag = lag;
+	data_->maxSize = maxSize;
+	data_->toDetrend = toDetrend;
+	data_->aggr = aggr;
+	data_->envDelay.assign(onsetShift, 0);
+
+	data_->baseC = baseC;
+	data_->norm = norm;
+	data_->threshold = threshold;
+
+	data_->spectr.resize(data_->nRing * nBins);
+	data_->percMed.resize(data_->nRing * nBins);
+	data_->window.resize(data_->kernelHarm);
+	data_->percPrev.resize(lag * nBins);
+	data_->percDiff.resize(nBins);
+	data_->folding = HarmonicPercussive::ChromaBins(nBins, binsPerOctave, fMin, baseC, nChroma, window);
+	data_->chrSum.assign(nChroma, 0);
+}
+HpssStream::~HpssStream() {} // C4710 Function not inlined
+
+void HpssStream::Push(const float* frames, const size_t nFrames)
+{
+	assert(not data_->isFlushed and "Pushing frames after flush");
+	for (size_t i(0); i < nFrames; ++i)
+	{
+		const auto row(data_->nReceived % data_->nRing * data_->nBins);
+		CHECK_IPP_RESULT(ippsCopy_32f(frames + static_cast<ptrdiff_t>(i * data_->nBins),
+			data_->spectr.data() + static_cast<ptrdiff_t>(row), static_cast<int>(data_->nBins)));
+		SlidingMedian::AlongBins(data_->spectr.data() + static_cast<ptrdiff_t>(row), 1, data_->nBins,
+			data_->kernelPerc, data_->percMed.data() + static_cast<ptrdiff_t>(row));
+		++data_->nReceived;
+
+		// The oldest frame still needed is (nReceived - nRing), the one just overwritten is not needed any more:
+		for (; data_->nCalculated + data_->half < data_->nReceived; ++data_->nCalculated)
+			CalcFrame(data_->nCalculated, data_->nReceived);
+	}
+}
+
+void HpssStream::Flush()
+{
+	if (data_->isFlushed) return;
+	data_->isFlushed = true;
+	// Total duration is known now, so the right-end can be mirrored:
+	for (; data_->nCalculated < data_->nReceived; ++data_->nCalculated)
+		CalcFrame(data_->nCalculated, data_->nReceived);
+}
+
+size_t HpssStream::GetNumFrames() const { return data_->env.size() - data_->nRead; }
+size_t HpssStream::GetLatency() const { return data_->half; }
+
+size_t HpssStream::Read(float* harm, float* perc, float* onsetEnv, float* chroma, const size_t maxFrames)
+{
+	const auto nFrames(min(maxFrames, GetNumFrames()));
+	if (nFrames == 0) return 0;
+
+	// Read frames are dropped from the front only when they are at least a half of the buffers,
+	// so that every value is moved a constant number of times on average, not on every read:
+	const auto isCompacted(2 * (data_->nRead + nFrames) >= data_->env.size());
+	const auto ReadRows([this, nFrames, isCompacted](vector<float>& src, float* dest, const size_t nCols)
+	{
+		if (dest) CHECK_IPP_RESULT(ippsCopy_32f(src.data() + static_cast<ptrdiff_t>(data_->nRead * nCols),
+			dest, static_cast<int>(nFrames * nCols)));
+		if (isCompacted) src.erase(src.cbegin(), src.cbegin() + static_cast<ptrdiff_t>((data_->nRead + nFrames) * nCols));
+	});
+	ReadRows(data_->harm, harm, data_->nBins);
+	ReadRows(data_->perc, perc, data_->nBins);
+	ReadRows(data_->env, onsetEnv, 1);
+	ReadRows(data_->chroma, chroma, data_->nChroma);
+	data_->nRead = isCompacted ? 0 : data_->nRead + nFrames;
+	return nFrames;
+}
+
+string HpssStream::KeySignature() const
+{
+	assert(data_->nChroma == 12 and "Key signature needs 12-bin chroma pitch profile");
+	return HarmonicPercussive::KeySignature(data_->chrSum, data_->baseC);
+}
+
+
+void HpssStream::CalcFrame(const size_t t, const size_t nFrames)
+{
+	// Before flush, nFrames is the number of frames received so far, and the window never reaches its right-end:
+	assert(t < nFrames and (data_->isFlushed or t + data_->half < nFrames) and "Not enough look-ahead frames");
+	const auto row(t % data_->nRing * data_->nBins);
+
+	const auto harmFirst(data_->harm.size());
+	data_->harm.resize(harmFirst + data_->nBins);
+	data_->perc.resize(harmFirst + data_->nBins);
+	const auto harm(data_->harm.data() + static_cast<ptrdiff_t>(harmFirst)),
+		perc(data_->perc.data() + static_cast<ptrdiff_t>(harmFirst));
+	for (size_t j(0); j < data_->nBins; ++j)
+	{
+		// Same mirrored window as SlidingMedian::AlongTime, but the median is selected afresh every frame,
+		// because the ring buffer rows are not contiguous in time:
+		for (size_t i(0); i < data_->kernelHarm; ++i) data_->window.at(i) = data_->spectr.at(
+			SlidingMedian::Mirror(static_cast<ptrdiff_t>(t + i) - static_cast<ptrdiff_t>(data_->half),
+				nFrames) % data_->nRing * data_->nBins + j);
+		nth_element(data_->window.begin(), data_->window.begin()
+			+ static_cast<ptrdiff_t>(data_->half), data_->window.end());
+
+		const auto harmMed(data_->window.at(data_->half)), percMed(data_->percMed.at(row + j)),
+			spectr(data_->spectr.at(row + j));
+		harm[j] = HarmonicPercussive::SoftMask(harmMed, percMed * data_->margHarm,
+			data_->power, data_->splitZeros) * spectr;
+		perc[j] = HarmonicPercussive::SoftMask(percMed, harmMed * data_->margPerc,
+			data_->power, data_->splitZeros) * spectr;
+	}
+
+	// Onset envelope needs the percussive frame lag frames back, which is in the same ring row:
+	const auto prev(data_->percPrev.data() + static_cast<ptrdiff_t>(t % data_->lag * data_->nBins));
+	float envVal(0);
+	if (t >= data_->lag) OnsetFrame(perc, prev, &envVal);
+	CHECK_IPP_RESULT(ippsCopy_32f(perc, prev, static_cast<int>(data_->nBins)));
+
+	data_->envDelay.push_back(envVal);
+	envVal = data_->envDelay.front();
+	data_->envDelay.pop_front();
+	if (data_->toDetrend) // same IIR filter as in HarmonicPercussive::OnsetEnvelope:
+	{
+		const auto result(envVal - data_->detrendX + .99f * data_->detrendY);
+		data_->detrendX = envVal;
+		data_->detrendY = envVal = result;
+	}
+	data_->env.push_back(envVal);
+
+	const auto chromaFirst(data_->chroma.size());
+	data_->chroma.resize(chromaFirst + data_->nChroma);
+	ChromaFrame(harm, data_->chroma.data() + static_cast<ptrdiff_t>(chromaFirst));
+}
+
+void HpssStream::OnsetFrame(const float* perc, const float* prev, float* dest)
+{
+	// S[f, t] - Sref[f, t - lag], where Sref is maximum over maxSize neighbouring bins,
+	// and bins outside of the spectrum are zeros (same as ippBorderConst):
+	const auto nBins(static_cast<ptrdiff_t>(data_->nBins)), before((data_->maxSize - 1) / 2),
+		after(data_->maxSize / 2);
+	for (ptrdiff_t j(0); j < nBins; ++j)
+	{
+		auto ref(j - before < 0 or j + after >= nBins ? 0 : numeric_limits<float>::lowest());
+		for (auto i(max(j - before, static_cast<ptrdiff_t>(0))); i <= min(j + after, nBins - 1); ++i)
+			ref = max(ref, prev[i]);
+		data_->percDiff.at(static_cast<size_t>(j)) = max(perc[j] - ref, 0.f); // Discard negatives
+	}
+	Aggregate(data_->percDiff.data(), 1, 0, static_cast<int>(data_->nBins), dest, data_->aggr);
+}
+
+void HpssStream::ChromaFrame(const float* harm, float* dest)
+{
+	// Global maximum is not known while streaming, so decibels are converted to amplitude without the shift,
+	// it is only a common factor, and it cancels out in any normalization:
+	HarmonicPercussive::FoldChroma(harm, 1, data_->folding, 0, data_->norm, data_->threshold, dest);
+	CHECK_IPP_RESULT(ippsAdd_32f_I(dest, data_->chrSum.data(), static_cast<int>(data_->nChroma)));
+}
\ No newline at end of file
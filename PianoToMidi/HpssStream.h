@@ -0,0 +1,39 @@
+#pragma once
+
+class HpssStream
+{
+public:
+	// Same parameters as HarmonicPercussive, OnsetEnvelope and Chromagram,
+	// but decibel CQT comes in blocks of frames, for example from CqtStream.
+	// onsetShift - frames of zeros to prepend to onset envelope (FFT frame length / 2 / hop, same as toCenter),
+	// only the ring buffer of kernelHarm frames is kept, so memory does not depend on audio duration:
+	explicit HpssStream(size_t nBins, int binsPerOctave, float fMin,
+		int kernelHarm = 31, int kernelPerc = 31, float power = 2.f,
+		float marginHarm = 1.f, float marginPerc = 1.f,
+		size_t lag = 1, int maxSize = 1, bool toDetrend = false, size_t onsetShift = 0,
+		AGGREGATE aggregate = AGGREGATE::MEAN, bool baseC = true, NORM_TYPE norm = NORM_TYPE::INF,
+		float threshold = 0.f, size_t nChromaOutput = 12, WIN_FUNC window = WIN_FUNC::RECT);
+	~HpssStream();
+
+	void Push(const float* cqtFrames, size_t nFrames); // frame-major, nBins per frame
+	void Flush(); // end of input, right-end gets mirrored, and the remaining frames become ready
+
+	size_t GetNumFrames() const; // ready to be read
+	// Frame-major, nBins (nChroma for chroma) per frame, any destination can be nullptr if not needed,
+	// returns number of frames actually read:
+	size_t Read(float* harm, float* perc, float* onsetEnv, float* chroma, size_t maxFrames);
+
+	// Input frames needed after the output frame before it is ready:
+	size_t GetLatency() const;
+	// Krumhansl-Schmuckler estimate over the chroma of all frames calculated so far:
+	std::string KeySignature() const;
+private:
+	void CalcFrame(size_t frame, size_t nFrames); // nFrames received so far, or total after flush
+	void OnsetFrame(const float* perc, const float* prevPerc, float* dest);
+	void ChromaFrame(const float* harm, float* dest);
+
+	const std::unique_ptr<struct HpssStreamData> data_;
+
+	HpssStream(const HpssStream&) = delete;
+	const HpssStream& operator=(const HpssStream&) = delete;
+};
\ No newline at end of file
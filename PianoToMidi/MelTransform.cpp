@@ -13,39 +13,50 @@
 using namespace std;
 
 MelTransform::MelTransform(const shared_ptr<AudioLoader>& audio, const size_t rate, const size_t nMels, const float fMin, const float fMax,
-	const bool htk, const bool norm, const size_t nFft, const int hopLen, const WIN_FUNC window, const PAD_MODE pad, const float power)
+	const bool htk, const bool norm, const size_t nFft, const int hopLen, const WIN_FUNC window, const PAD_MODE pad, const float power,
+	const size_t framesTile)
+	: MelTransform(reinterpret_cast<const float*>(audio->GetRawData()), audio->GetNumSamples(),
+		rate, nMels, fMin, fMax, htk, norm, nFft, hopLen, window, pad, power, framesTile)
+{
+	assert(audio->GetBytesPerSample() == sizeof(float) and "Raw audio data is assumed to be in float-format before calculating MEL-spectrogram");
+}
+MelTransform::MelTransform(const float* samples, const size_t nSamples, const size_t rate, const size_t nMels, const float fMin, const float fMax,
+	const bool htk, const bool norm, const size_t nFft, const int hopLen, const WIN_FUNC window, const PAD_MODE pad, const float power,
+	const size_t framesTile)
 	: hopLen_(hopLen),
 	mel_(make_shared<AlignedVector<float>>())
 {
 	assert(power > 0 and "Power must be positive (e.g. 1 for energy, 2 for power, etc.)");
-	assert(audio->GetBytesPerSample() == sizeof(float) and "Raw audio data is assumed to be in float-format before calculating MEL-spectrogram");
-	ShortTimeFourier stft(nFft, window, pad);
-	stft.RealForward(reinterpret_cast<float*>(audio->GetRawData()), audio->GetNumSamples(), hopLen);
-
-	AlignedVector<float> stftData(stft.GetSTFT().size());
-	CHECK_IPP_RESULT(ippsMagnitude_32fc(reinterpret_cast<const Ipp32fc*>(stft.GetSTFT().data()), stftData.data(), static_cast<int>(stftData.size())));
-
-	if (power != 1) CHECK_IPP_RESULT(power == 2 ? ippsSqr_32f(stftData.data(), stftData.data(), static_cast<int>(stftData.size()))
-		: ippsPowx_32f_A11(stftData.data(), power, stftData.data(), static_cast<Ipp32s>(stftData.size())));
-
 	assert(fftFreqs_.empty() and "Fft frequencies should not have been calculated until here");
 	fftFreqs_.resize(1 + nFft / 2); // Center freqs of each FFT bin
 //	const auto delta(static_cast<float>(rate / 2. / (fftFreqs_.size() - 1)));
 //	for (auto iter(next(fftFreqs_.begin())); iter != fftFreqs_.cend(); ++iter)* iter = *prev(iter) + delta;
 	for (size_t i(0); i < fftFreqs_.size(); ++i) fftFreqs_.at(i) = static_cast<float>(i * (rate / 2.) / (fftFreqs_.size() - 1));
-
 	MelFilters(rate, nMels, fMin, fMax, htk, norm);
-	mel_->resize(nMels * stft.GetNumFrames());
-	cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, static_cast<int>(nMels), static_cast<int>(stft.GetNumFrames()), static_cast<int>(1 + nFft / 2),
-		1, melWeights_.data(), static_cast<int>(1 + nFft / 2),
-		stftData.data(), static_cast<int>(stft.GetNumFrames()), 0, mel_->data(), static_cast<int>(stft.GetNumFrames()));
+
+	// Every mel frame depends on its own STFT frame only, so STFT (the largest buffer here) is calculated in tiles of frames:
+	const auto nFrames(nSamples / static_cast<size_t>(hopLen) + 1), tile(framesTile ? framesTile : nFrames);
+	mel_->resize(nFrames * nMels);
+	ShortTimeFourier stft(nFft, window, pad);
+	AlignedVector<float> stftData;
+	for (size_t first(0); first < nFrames; first += tile)
+	{
+		stft.RealForward(samples, nSamples, hopLen, first, tile);
+		stftData.resize(stft.GetSTFT().size());
+		CHECK_IPP_RESULT(ippsMagnitude_32fc(reinterpret_cast<const Ipp32fc*>(stft.GetSTFT().data()), stftData.data(), static_cast<int>(stftData.size())));
+
+		if (power != 1) CHECK_IPP_RESULT(power == 2 ? ippsSqr_32f(stftData.data(), stftData.data(), static_cast<int>(stftData.size()))
+			: ippsPowx_32f_A11(stftData.data(), power, stftData.data(), static_cast<Ipp32s>(stftData.size())));
+
+		// STFT is frame-major, so multiply it by transposed filter bank, and mel-spectrum will be frame-major as well:
+		cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasTrans, static_cast<int>(stft.GetNumFrames()), static_cast<int>(nMels), static_cast<int>(1 + nFft / 2),
+			1, stftData.data(), static_cast<int>(1 + nFft / 2),
+			melWeights_.data(), static_cast<int>(1 + nFft / 2), 0, mel_->data() + static_cast<ptrdiff_t>(first * nMels), static_cast<int>(nMels));
+	}
 	fftFreqs_.clear();
 	assert(not melWeights_.empty() and "Mel filters should have already been calculated");
 	melWeights_.clear();
 
-	MKL_Simatcopy('R', 'T', nMels, stft.GetNumFrames(),
-		1, mel_->data(), stft.GetNumFrames(), nMels);
-
 	CalcNoteIndices();
 	assert(not melFreqs_.empty() and "Mel frequencies should have already been calculated");
 	melFreqs_.clear();
@@ -3,8 +3,14 @@
 class MelTransform
 {
 public:
+	// STFT is calculated in tiles of that many frames, to bound its memory, zero means the whole STFT at once:
 	explicit MelTransform(const std::shared_ptr<AudioLoader>&, size_t rate = 22'050, size_t nMels = 128, float fMin = 0, float fMax = 0, bool htk = false,
-		bool norm = true, size_t nFft = 2'048, int hopLen = 512, WIN_FUNC window = WIN_FUNC::HANN, PAD_MODE pad = PAD_MODE::MIRROR, float power = 2);
+		bool norm = true, size_t nFft = 2'048, int hopLen = 512, WIN_FUNC window = WIN_FUNC::HANN, PAD_MODE pad = PAD_MODE::MIRROR, float power = 2,
+		size_t framesTile = 0);
+	// Mono float samples, for example a window of a longer recording:
+	explicit MelTransform(const float* samples, size_t nSamples, size_t rate = 22'050, size_t nMels = 128, float fMin = 0, float fMax = 0, bool htk = false,
+		bool norm = true, size_t nFft = 2'048, int hopLen = 512, WIN_FUNC window = WIN_FUNC::HANN, PAD_MODE pad = PAD_MODE::MIRROR, float power = 2,
+		size_t framesTile = 0);
 	~MelTransform();
 	
 #pragma warning(push)
@@ -0,0 +1,85 @@
+#include "stdafx.h"
+#include "MemoryBudget.h"
+#ifdef _WIN32
+#	include <Psapi.h>
+#endif
+
+using namespace std;
+
+MemoryBudget::MemoryBudget(const size_t budget) : budget_(budget), stageTracked_(0), stageStart_(chrono::steady_clock::now()) {}
+MemoryBudget::~MemoryBudget() {} // C4710 Function not inlined
+
+void MemoryBudget::SetBudget(const size_t budget) { budget_ = budget; }
+bool MemoryBudget::Fits(const size_t trackedBytes) const { return budget_ == 0 or trackedBytes <= budget_; }
+size_t MemoryBudget::Headroom(const size_t trackedBytes) const
+{
+	return budget_ == 0 ? numeric_limits<size_t>::max() : trackedBytes < budget_ ? budget_ - trackedBytes : 0;
+}
+void MemoryBudget::Track(const size_t trackedBytes) { stageTracked_ = max(stageTracked_, trackedBytes); }
+
+void MemoryBudget::EndStage(const string& name, const size_t trackedBytes)
+{
+	Track(trackedBytes);
+	const auto now(chrono::steady_clock::now());
+	stages_.push_back({ name, stageTracked_, CurrentRss(), PeakRss(), chrono::duration<double>(now - stageStart_).count() });
+	stageTracked_ = trackedBytes;
+	stageStart_ = now;
+}
+
+string MemoryBudget::Report() const
+{
+	// Peak resident memory is never reset (it is shared by the whole process),
+	// so a stage is marked only if it has raised the peak:
+	const auto MB([](const size_t bytes) { return (bytes + (1 << 19)) >> 20; });
+	ostringstream os;
+	os << "Memory, MB:\ttracked\tresident\tpeak\tseconds";
+	if (budget_) os << "\t(budget " << MB(budget_) << ')';
+	size_t trackedMax(0), peakMax(0);
+	for (const auto& stage : stages_)
+	{
+		os << endl << stage.name << ":\t" << MB(stage.tracked) << '\t' << MB(stage.rss) << '\t' << MB(stage.peakRss)
+			<< (stage.peakRss > peakMax ? " *" : "") << '\t' << round(stage.seconds * 10) / 10
+			<< (Fits(stage.tracked) ? "" : "\tover budget");
+		trackedMax = max(trackedMax, stage.tracked);
+		peakMax = max(peakMax, stage.peakRss);
+	}
+	os << endl << "High-water:\t" << MB(trackedMax) << "\t\t" << MB(peakMax);
+	return move(os.str());
+}
+
+vector<pair<string, double>> MemoryBudget::GetStageSeconds() const
+{
+	vector<pair<string, double>> result;
+	for (const auto& stage : stages_) result.emplace_back(stage.name, stage.seconds);
+	return result;
+}
+size_t MemoryBudget::GetPeakRss() const
+{
+	size_t result(0);
+	for (const auto& stage : stages_) result = max(result, stage.peakRss);
+	return result;
+}
+
+#ifdef _WIN32
+size_t MemoryBudget::CurrentRss()
+{
+	PROCESS_MEMORY_COUNTERS counters{ sizeof counters };
+	return GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof counters) ? counters.WorkingSetSize : 0;
+}
+size_t MemoryBudget::PeakRss()
+{
+	PROCESS_MEMORY_COUNTERS counters{ sizeof counters };
+	return GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof counters) ? counters.PeakWorkingSetSize : 0;
+}
+#else
+static size_t ProcStatus(const char* key)
+{
+	// Lines like "VmRSS:     1234 kB":
+	ifstream status("/proc/self/status");
+	for (string line; getline(status, line);) if (line.compare(0, strlen(key), key) == 0)
+		return stoull(line.substr(strlen(key))) << 10;
+	return 0;
+}
+size_t MemoryBudget::CurrentRss() { return ProcStatus("VmRSS:"); }
+size_t MemoryBudget::PeakRss() { return ProcStatus("VmHWM:"); }
+#endif
\ No newline at end of file
@@ -0,0 +1,36 @@
+#pragma once
+
+class MemoryBudget
+{
+public:
+	explicit MemoryBudget(size_t budgetBytes = 0); // zero means no limit
+	~MemoryBudget();
+
+	void SetBudget(size_t budgetBytes);
+	// Whether the buffers would stay within the budget, if they took that many bytes in total:
+	bool Fits(size_t trackedBytes) const;
+	// Bytes left under the budget (maximum if there is no limit, zero if already over it):
+	size_t Headroom(size_t trackedBytes) const;
+
+	// Buffers tracked in the middle of a stage, only the largest value is kept:
+	void Track(size_t trackedBytes);
+	// Stage high-water mark is the largest of the tracked values, and process resident memory and its peak are sampled,
+	// stage time is counted from the previous EndStage (or from construction):
+	void EndStage(const std::string& name, size_t trackedBytes);
+	std::string Report() const;
+
+	std::vector<std::pair<std::string, double>> GetStageSeconds() const;
+	size_t GetPeakRss() const; // peak resident memory of the whole process, not only of these stages
+
+	// Resident set size of the process now, and its peak so far (zeros if the OS does not tell):
+	static size_t CurrentRss();
+	static size_t PeakRss();
+private:
+	struct Stage { std::string name; size_t tracked, rss, peakRss; double seconds; };
+	std::vector<Stage> stages_;
+	size_t budget_, stageTracked_;
+	std::chrono::steady_clock::time_point stageStart_;
+
+	MemoryBudget(const MemoryBudget&) = delete;
+	const MemoryBudget& operator=(const MemoryBudget&) = delete;
+};
\ No newline at end of file
@@ -0,0 +1,126 @@
+#include "stdafx.h"
+#include "MidiWriter.h"
+#include "NoteIntervals.h"
+
+using namespace std;
+
+MidiWriter::MidiWriter(const int ppqn) : ppqn_(ppqn)
+{
+	assert(ppqn > 0 and ppqn < 0x8000 and "Wrong number of ticks per quarter note");
+}
+MidiWriter::~MidiWriter() {} // C4710 Function not inlined
+
+void MidiWriter::PutVarLen(vector<uint8_t>& bytes, const uint32_t value)
+{
+	// Seven bits per byte, most significant first, all the bytes but the last one have the top bit set:
+	assert(value < 0x1000'0000 and "Variable-length quantity is too large");
+	for (auto shift(21); shift > 0; shift -= 7) if (value >> shift)
+		bytes.push_back(static_cast<uint8_t>(0x80 | (value >> shift & 0x7F)));
+	bytes.push_back(static_cast<uint8_t>(value & 0x7F));
+}
+void MidiWriter::PutBigEndian(vector<uint8_t>& bytes, const uint32_t value, const size_t nBytes)
+{
+	for (auto i(nBytes); i; --i) bytes.push_back(static_cast<uint8_t>(value >> (8 * (i - 1)) & 0xFF));
+}
+
+void MidiWriter::AddMeta(const uint32_t tick, const uint8_t type, const vector<uint8_t>& data)
+{
+	assert((meta_.empty() or meta_.back().first <= tick) and "Meta events should be added in order of their ticks");
+	vector<uint8_t> event{ 0xFF, type };
+	PutVarLen(event, static_cast<uint32_t>(data.size()));
+	event.insert(event.cend(), data.cbegin(), data.cend());
+	meta_.emplace_back(tick, move(event));
+}
+void MidiWriter::AddText(const uint8_t type, const string& text, const uint32_t tick)
+{
+	assert(type >= 1 and type <= 0x0F and "Wrong text meta event type");
+	AddMeta(tick, type, vector<uint8_t>(text.cbegin(), text.cend()));
+}
+void MidiWriter::AddKeySignature(const int sharpsOrFlats, const bool isMinor, const uint32_t tick)
+{
+	assert(sharpsOrFlats >= -7 and sharpsOrFlats <= 7 and "Wrong number of sharps or flats");
+	AddMeta(tick, 0x59, { static_cast<uint8_t>(static_cast<int8_t>(sharpsOrFlats)), isMinor });
+}
+void MidiWriter::AddTempo(const double bpm, const uint32_t tick)
+{
+	assert(bpm > 0 and "Tempo must be positive");
+	vector<uint8_t> data;
+	PutBigEndian(data, static_cast<uint32_t>(min(round(60'000'000 / bpm), static_cast<double>(0xFF'FFFF))), 3);
+	AddMeta(tick, 0x51, data);
+}
+
+vector<uint8_t> MidiWriter::Encode(const NoteList& notes, const vector<uint32_t>& frameTicks,
+	const uint8_t channel) const
+{
+	assert(channel < 16 and "Wrong MIDI channel");
+	assert(is_sorted(frameTicks.cbegin(), frameTicks.cend()) and "Frame ticks should not decrease");
+
+	/* Two counting-sort passes (least significant key first), so the whole sort is linear:
+		1. Notes by pitch.
+		2. Their events by frame, note-off before note-on, pitches stay in order within a bucket.
+	Event is the note index, shifted left by one, and the lowest bit is set for note-on. */
+	vector<uint32_t> byPitch(notes.size()), events(2 * notes.size());
+	array<size_t, 89> pitchStarts{ 0 };
+	for (const auto p : notes.pitch) ++pitchStarts.at(p + 1u);
+	partial_sum(pitchStarts.cbegin(), pitchStarts.cend(), pitchStarts.begin());
+	for (size_t i(0); i < notes.size(); ++i) byPitch.at(pitchStarts.at(notes.pitch.at(i))++) = static_cast<uint32_t>(i);
+
+	vector<size_t> eventStarts(2 * frameTicks.size() + 1);
+	for (size_t i(0); i < notes.size(); ++i)
+	{
+		assert(notes.start.at(i) < notes.end.at(i) and notes.end.at(i) < frameTicks.size() and "Wrong note interval");
+		++eventStarts.at(2 * notes.end.at(i) + 1);
+		++eventStarts.at(2 * notes.start.at(i) + 2);
+	}
+	partial_sum(eventStarts.cbegin(), eventStarts.cend(), eventStarts.begin());
+	for (const auto i : byPitch)
+	{
+		events.at(eventStarts.at(2 * notes.end.at(i))++) = i << 1;
+		events.at(eventStarts.at(2 * notes.start.at(i) + 1)++) = i << 1 | 1;
+	}
+
+	// One forward pass, meta events go before notes of the same tick, so a new tempo applies to them:
+	vector<uint8_t> track;
+	track.reserve(4 * events.size() + 64);
+	uint32_t lastTick(0);
+	uint8_t runStatus(0); // repeated status byte may be omitted, meta events cancel it
+	const auto PutDelta([&track, &lastTick](const uint32_t tick)
+	{
+		PutVarLen(track, tick - lastTick);
+		lastTick = tick;
+	});
+	auto meta(meta_.cbegin());
+	const auto PutMetaUntil([&](const uint32_t tick)
+	{
+		for (; meta != meta_.cend() and meta->first <= tick; ++meta)
+		{
+			PutDelta(meta->first);
+			track.insert(track.cend(), meta->second.cbegin(), meta->second.cend());
+			runStatus = 0;
+		}
+	});
+	for (const auto e : events)
+	{
+		const auto note(e >> 1);
+		const auto isOn((e & 1) != 0);
+		const auto tick(frameTicks.at(isOn ? notes.start.at(note) : notes.end.at(note)));
+		PutMetaUntil(tick);
+
+		PutDelta(tick);
+		const auto status(static_cast<uint8_t>((isOn ? 0x90 : 0x80) | channel));
+		if (status != runStatus) track.push_back(runStatus = status);
+		track.push_back(static_cast<uint8_t>(notes.pitch.at(note) + 21));
+		track.push_back(isOn ? static_cast<uint8_t>(min(max(static_cast<int>(notes.velocity.at(note)), 1), 127)) : 0);
+	}
+	PutMetaUntil(numeric_limits<uint32_t>::max());
+	PutDelta(lastTick);
+	track.insert(track.cend(), { 0xFF, 0x2F, 0 }); // end of track
+
+	// Header chunk, format 1 with the only track:
+	vector<uint8_t> result{ 'M', 'T', 'h', 'd', 0, 0, 0, 6, 0, 1, 0, 1 };
+	PutBigEndian(result, static_cast<uint32_t>(ppqn_), 2);
+	result.insert(result.cend(), { 'M', 'T', 'r', 'k' });
+	PutBigEndian(result, static_cast<uint32_t>(track.size()), 4);
+	result.insert(result.cend(), track.cbegin(), track.cend());
+	return result;
+}
\ No newline at end of file
@@ -0,0 +1,31 @@
+#pragma once
+
+class MidiWriter
+{
+public:
+	explicit MidiWriter(int ticksPerQuarterNote = 480);
+	~MidiWriter();
+
+	// Meta events must be added in order of their ticks:
+	void AddText(uint8_t type, const std::string& text, uint32_t tick = 0);
+	void AddKeySignature(int sharpsOrFlats, bool isMinor, uint32_t tick = 0);
+	void AddTempo(double bpm, uint32_t tick = 0);
+
+	// Standard MIDI file with one track, frameTicks - ticks of frames 0...nFrames (the last frame ends the notes),
+	// note-offs go before note-ons of the same tick, so a repeated key is released before it is struck again:
+	std::vector<uint8_t> Encode(const struct NoteList& notes,
+		const std::vector<uint32_t>& frameTicks, uint8_t channel = 0) const;
+private:
+	void AddMeta(uint32_t tick, uint8_t type, const std::vector<uint8_t>& data);
+	static void PutVarLen(std::vector<uint8_t>& bytes, uint32_t value);
+	static void PutBigEndian(std::vector<uint8_t>& bytes, uint32_t value, size_t nBytes);
+
+	std::vector<std::pair<uint32_t, std::vector<uint8_t>>> meta_; // (tick, event without delta-time)
+	const int ppqn_;
+#ifdef _WIN64
+	const byte pad_[4]{ 0 };
+#endif
+
+	MidiWriter(const MidiWriter&) = delete;
+	const MidiWriter& operator=(const MidiWriter&) = delete;
+};
\ No newline at end of file
@@ -0,0 +1,134 @@
+#include "stdafx.h"
+#include "NoteIntervals.h"
+#include "ProbabilityMap.h"
+
+using namespace std;
+
+NoteIntervals::Mask NoteIntervals::Greater(const float* probs, const float threshold)
+{
+	// Four pitches per SSE compare, movemask packs their signs into four bits:
+	Mask result{ 0 };
+	const auto thresh(_mm_set1_ps(threshold));
+	for (size_t i(0); i < 88; i += 4) result.at(i / 32) |= static_cast<uint32_t>(
+		_mm_movemask_ps(_mm_cmpgt_ps(_mm_loadu_ps(probs + i), thresh))) << (i % 32);
+	return result;
+}
+
+NoteIntervals::Mask NoteIntervals::Less(const float* probs, const float threshold)
+{
+	Mask result{ 0 };
+	const auto thresh(_mm_set1_ps(threshold));
+	for (size_t i(0); i < 88; i += 4) result.at(i / 32) |= static_cast<uint32_t>(
+		_mm_movemask_ps(_mm_cmplt_ps(_mm_loadu_ps(probs + i), thresh))) << (i % 32);
+	return result;
+}
+
+NoteIntervals::Mask NoteIntervals::Greater(const uint8_t* probs, const uint8_t threshold)
+{
+	// Sixteen pitches per SSE2 compare, bytes are unsigned, so their top bits are flipped for the signed compare,
+	// the last 8 pitches are loaded into the lower half, and the zeros in the upper half are masked out:
+	const auto bias(_mm_set1_epi8(static_cast<char>(0x80))),
+		thresh(_mm_xor_si128(_mm_set1_epi8(static_cast<char>(threshold)), bias));
+	const auto Bits([bias, thresh](const __m128i x)
+		{ return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpgt_epi8(_mm_xor_si128(x, bias), thresh))); });
+	const auto src(reinterpret_cast<const __m128i*>(probs));
+	return Mask{ Bits(_mm_loadu_si128(src)) | Bits(_mm_loadu_si128(src + 1)) << 16,
+		Bits(_mm_loadu_si128(src + 2)) | Bits(_mm_loadu_si128(src + 3)) << 16,
+		Bits(_mm_loadu_si128(src + 4)) | (Bits(_mm_loadl_epi64(src + 5)) & 0xFF) << 16 };
+}
+
+NoteIntervals::Mask NoteIntervals::Less(const uint8_t* probs, const uint8_t threshold)
+{
+	const auto bias(_mm_set1_epi8(static_cast<char>(0x80))),
+		thresh(_mm_xor_si128(_mm_set1_epi8(static_cast<char>(threshold)), bias));
+	const auto Bits([bias, thresh](const __m128i x)
+		{ return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmplt_epi8(_mm_xor_si128(x, bias), thresh))); });
+	const auto src(reinterpret_cast<const __m128i*>(probs));
+	return Mask{ Bits(_mm_loadu_si128(src)) | Bits(_mm_loadu_si128(src + 1)) << 16,
+		Bits(_mm_loadu_si128(src + 2)) | Bits(_mm_loadu_si128(src + 3)) << 16,
+		Bits(_mm_loadu_si128(src + 4)) | (Bits(_mm_loadl_epi64(src + 5)) & 0xFF) << 16 };
+}
+
+uint32_t NoteIntervals::LowestBit(const uint32_t word)
+{
+	assert(word and "No bits to scan");
+#ifdef _MSC_VER
+	unsigned long result;
+	_BitScanForward(&result, word);
+	return result;
+#else
+	return static_cast<uint32_t>(__builtin_ctz(word));
+#endif
+}
+
+NoteList NoteIntervals::Extract(const float* onsetProbs, const float* frameProbs, const float* volumeProbs,
+	const size_t nFrames, const DecodeParams& params)
+{
+	return Extract(onsetProbs, frameProbs, volumeProbs, nFrames,
+		params.onsetThreshold, params.onsetThreshold, params.frameThreshold, 1, params);
+}
+NoteList NoteIntervals::Extract(const uint8_t* onsetProbs, const uint8_t* frameProbs, const uint8_t* volumeProbs,
+	const size_t nFrames, const DecodeParams& params)
+{
+	// Quantized q is above threshold t, if q / levels > t, that is q > floor(t * levels),
+	// and below it, if q < ceil(t * levels):
+	assert(params.onsetThreshold >= 0 and params.onsetThreshold <= 1
+		and params.frameThreshold >= 0 and params.frameThreshold <= 1 and "Thresholds should be probabilities");
+	const auto Floor([](const float t) { return static_cast<uint8_t>(floor(t * ProbabilityMap::levels)); });
+	const auto Ceil([](const float t) { return static_cast<uint8_t>(ceil(t * ProbabilityMap::levels)); });
+	return Extract(onsetProbs, frameProbs, volumeProbs, nFrames, Floor(params.onsetThreshold),
+		Ceil(params.onsetThreshold), Floor(params.frameThreshold), 1 / ProbabilityMap::levels, params);
+}
+
+template<typename T> NoteList NoteIntervals::Extract(const T* onsetProbs, const T* frameProbs, const T* volumeProbs,
+	const size_t nFrames, const T onsetGreater, const T onsetLess, const T frameGreater, const float volumeScale,
+	const DecodeParams& params)
+{
+	/* Same rules as in Magenta Onsets and Frames, but for all the 88 pitches at once:
+		frame is active if it has either onset or frame prediction,
+		note starts only at an onset, and ends at the first inactive frame,
+		or at a new onset, if the previous frame had no onset */
+
+	NoteList result;
+	array<uint32_t, 88> starts{ 0 };
+	Mask open{ 0 }, prevLow{ 0 }; // notes still playing, and pitches without onset in the previous frame
+
+	const auto AddNotes([&](const Mask& ends, const uint32_t frame)
+	{
+		for (size_t w(0); w < nWords; ++w) for (auto bits(ends.at(w)); bits; bits &= bits - 1)
+		{
+			const auto pitch(w * 32 + LowestBit(bits));
+			if (frame - starts.at(pitch) < params.minFrames) continue;
+			result.pitch.push_back(static_cast<uint8_t>(pitch));
+			result.start.push_back(starts.at(pitch));
+			result.end.push_back(frame);
+			result.velocity.push_back(static_cast<uint8_t>(min(max(static_cast<int>(volumeProbs[starts.at(pitch) * 88
+				+ pitch] * volumeScale * params.velocityScale + params.velocityOffset), 1), 127)));
+		}
+	});
+	const auto StartNotes([&](const Mask& begins, const uint32_t frame)
+	{
+		for (size_t w(0); w < nWords; ++w) for (auto bits(begins.at(w)); bits; bits &= bits - 1)
+			starts.at(w * 32 + LowestBit(bits)) = frame;
+	});
+
+	for (size_t i(0); i < nFrames; ++i)
+	{
+		const auto onset(Greater(onsetProbs + static_cast<ptrdiff_t>(i * 88), onsetGreater)),
+			frame(Greater(frameProbs + static_cast<ptrdiff_t>(i * 88), frameGreater));
+		Mask ends, begins;
+		for (size_t w(0); w < nWords; ++w)
+		{
+			const auto active(onset.at(w) | frame.at(w)), // any frame with an onset is active
+				restart(open.at(w) & onset.at(w) & prevLow.at(w));
+			ends.at(w) = (open.at(w) & ~active) | restart;
+			begins.at(w) = (~open.at(w) & onset.at(w)) | restart;
+			open.at(w) = (open.at(w) & ~ends.at(w)) | begins.at(w);
+		}
+		AddNotes(ends, static_cast<uint32_t>(i)); // ended notes go before the ones started in the same frame
+		StartNotes(begins, static_cast<uint32_t>(i));
+		prevLow = Less(onsetProbs + static_cast<ptrdiff_t>(i * 88), onsetLess);
+	}
+	AddNotes(open, static_cast<uint32_t>(nFrames)); // silent frame at the end terminates notes still active
+	return result;
+}
\ No newline at end of file
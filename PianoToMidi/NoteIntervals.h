@@ -0,0 +1,48 @@
+#pragma once
+
+// Struct of arrays, notes are in order of their ends (frame, then pitch):
+struct NoteList
+{
+	std::vector<uint8_t> pitch; // 0...87 (midi note - 21)
+	std::vector<uint32_t> start, end; // frames, end is the first silent frame
+	std::vector<uint8_t> velocity;
+
+#pragma warning(push)
+#pragma warning(disable:4514) // Unreferenced inline function has been removed
+	size_t size() const { return pitch.size(); }
+#pragma warning(pop)
+};
+
+// Decoding of the RNN probabilities, defaults are the same as in Magenta Onsets and Frames:
+struct DecodeParams
+{
+	float onsetThreshold = .5f, frameThreshold = .5f;
+	uint32_t minFrames = 1; // shorter notes are dropped
+	float velocityScale = 80, velocityOffset = 10; // velocity = volume probability * scale + offset
+};
+
+class NoteIntervals
+{
+public:
+	// Frame-major probabilities (nFrames x 88), none of them is changed:
+	static NoteList Extract(const float* onsetProbs, const float* frameProbs, const float* volumeProbs,
+		size_t nFrames, const DecodeParams& params = DecodeParams());
+	// The same for probabilities quantized by ProbabilityMap, thresholds are compared in the same quantized steps:
+	static NoteList Extract(const uint8_t* onsetProbs, const uint8_t* frameProbs, const uint8_t* volumeProbs,
+		size_t nFrames, const DecodeParams& params = DecodeParams());
+private:
+	// 88 pitches of every frame are three 32-bit words (32 + 32 + 24 bits):
+	static constexpr size_t nWords = 3;
+	typedef std::array<uint32_t, nWords> Mask;
+
+	template<typename T> static NoteList Extract(const T* onsetProbs, const T* frameProbs, const T* volumeProbs,
+		size_t nFrames, T onsetGreater, T onsetLess, T frameGreater, float volumeScale, const DecodeParams& params);
+
+	static Mask Greater(const float* probs, float threshold);
+	static Mask Less(const float* probs, float threshold);
+	static Mask Greater(const uint8_t* probs, uint8_t threshold);
+	static Mask Less(const uint8_t* probs, uint8_t threshold);
+	static uint32_t LowestBit(uint32_t word);
+
+	NoteIntervals() = delete; // static members only, and the header is portable, without MSVC abstract
+};
\ No newline at end of file
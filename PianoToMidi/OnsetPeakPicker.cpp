@@ -0,0 +1,113 @@
+#include "stdafx.h"
+#include "OnsetPeakPicker.h"
+
+using namespace std;
+
+size_t OddLength(const double frames)
+{
+	auto result(static_cast<size_t>(ceil(frames)));
+	return result + result % 2 + 1; // odd filter size, just in case
+}
+
+OnsetPeakPicker::OnsetPeakPicker(const int rate, const int hopLen, const bool toBackTrack, const float range,
+	const float delta, const float maxSeconds, const float avgSeconds, const float waitSeconds)
+	: maxLen_(OddLength(static_cast<double>(maxSeconds) * rate / hopLen)),
+	avgHalf_(OddLength(static_cast<double>(avgSeconds) * rate / hopLen) / 2),
+	wait_(static_cast<size_t>(ceil(static_cast<double>(waitSeconds) * rate / hopLen))),
+	delta_(delta), range_(range), toBackTrack_(toBackTrack), isFlushed_(false),
+	histFirst_(0), nReceived_(0), nDecided_(0), sum_(0),
+	minVal_(numeric_limits<float>::max()), maxVal_(numeric_limits<float>::lowest()), lastPeak_(0)
+{
+	/* Flexible heuristic with the following three conditions:
+		1. x[n] == max(x[n - preMax : n])
+		2. x[n] >= mean(x[n - preAvg : n + postAvg]) + delta
+		3. n - previous_n (last peak) > wait (greedy)
+
+		Where parameter settings found by large-scale hyper-parameter optimization
+		over the dataset from https://github.com/CPJKU/onset_db
+
+		1. Boeck, Sebastian, Florian Krebs, and Markus Schedl.
+			"Evaluating the Online Capabilities of Onset Detection Methods." ISMIR, 2012.
+		2. https://github.com/CPJKU/onset_detection/blob/master/onset_program.py
+
+	Maximum window is causal, so only the average needs look-ahead of postAvg frames.
+	Running maximum is a deque of decreasing values, running sum is updated by one value in and one out,
+	and the greedy wait is checked right away, so every frame is decided once, as soon as its look-ahead comes */
+
+	assert(rate > 0 and hopLen > 0 and "Wrong onset envelope sample rate");
+	assert(range >= 0 and "Onset envelope range cannot be negative");
+}
+OnsetPeakPicker::~OnsetPeakPicker() {} // C4710 Function not inlined
+
+float OnsetPeakPicker::At(const size_t frame) const
+{
+	assert(frame >= histFirst_ and "Onset envelope frame has already been forgotten");
+	return hist_.at(frame - histFirst_);
+}
+
+void OnsetPeakPicker::Push(const float* env, const size_t nFrames)
+{
+	assert(not isFlushed_ and "Pushing onset envelope after flush");
+	for (size_t i(0); i < nFrames; ++i)
+	{
+		hist_.push_back(env[i]);
+		minVal_ = min(minVal_, env[i]);
+		maxVal_ = max(maxVal_, env[i]);
+		sum_ += env[i];
+		++nReceived_;
+
+		// Local minimum (energy non-increasing, then increasing) for back-tracking:
+		if (toBackTrack_ and nReceived_ >= 3)
+		{
+			const auto frame(nReceived_ - 2);
+			if (At(frame) <= At(frame - 1) and At(frame) < At(frame + 1)) minFrames_.push_back(frame);
+		}
+
+		for (; nDecided_ + avgHalf_ < nReceived_; ++nDecided_) Decide(nDecided_);
+	}
+}
+
+void OnsetPeakPicker::Flush()
+{
+	if (isFlushed_) return;
+	isFlushed_ = true;
+	for (; nDecided_ < nReceived_; ++nDecided_) Decide(nDecided_);
+}
+
+void OnsetPeakPicker::Decide(const size_t frame)
+{
+	const auto val(At(frame));
+
+	while (not maxFrames_.empty() and maxFrames_.front() + maxLen_ <= frame) maxFrames_.pop_front();
+	while (not maxFrames_.empty() and At(maxFrames_.back()) <= val) maxFrames_.pop_back();
+	maxFrames_.push_back(frame);
+
+	// Sliding average is truncated at the beginning and at the end:
+	const auto avgFirst(frame > avgHalf_ ? frame - avgHalf_ : 0);
+	if (frame > avgHalf_) sum_ -= At(avgFirst - 1);
+	const auto avg(sum_ / (nReceived_ - avgFirst));
+
+	if ((peaks_.empty() or frame > lastPeak_ + wait_)
+		and val == At(maxFrames_.front()) // Mask out entries not equal to the local max
+		// Then mask out all entries less than the thresholded average:
+		and val - avg >= delta_ * (range_ != 0 ? range_ : maxVal_ - minVal_))
+	{
+		lastPeak_ = frame;
+		if (toBackTrack_)
+		{
+			/* Roll back onset events from a peak amplitude to the nearest preceding energy minimum.
+			Primarily useful when using onsets as slice points for segmentation, as described by:
+			Jehan, Tristan. "Creating music by listening"
+			Doctoral dissertation
+			Massachusetts Institute of Technology, 2005. */
+			while (minFrames_.size() > 1 and minFrames_.at(1) < frame) minFrames_.pop_front();
+			peaks_.push_back(not minFrames_.empty() and minFrames_.front() < frame ? minFrames_.front() : 0);
+		}
+		else peaks_.push_back(frame);
+	}
+
+	// Forget what the next frame will not need: its maximum window, the value leaving its sum,
+	// and two frames before the next local minimum candidate:
+	const auto keepFirst(min({ frame + 2 > maxLen_ ? frame + 2 - maxLen_ : 0, avgFirst, frame ? frame - 1 : 0 }));
+	for (; histFirst_ < keepFirst; ++histFirst_) hist_.pop_front();
+}
\ No newline at end of file
@@ -0,0 +1,42 @@
+#pragma once
+
+class OnsetPeakPicker
+{
+public:
+	// Böck-Krebs-Schedl peak picking in one pass over the onset envelope,
+	// either offline (Push the whole envelope, then Flush), or while it is being calculated.
+	// range - threshold delta is relative to it, if zero, then range of the values pushed so far:
+	explicit OnsetPeakPicker(int sampleRate, int hopLength, bool toBackTrack = false, float range = 0,
+		float delta = .07f, float maxSeconds = .03f, float avgSeconds = .2f, float waitSeconds = .03f);
+	~OnsetPeakPicker();
+
+	void Push(const float* env, size_t nFrames);
+	void Flush(); // end of envelope, the last frames are decided with truncated average window
+
+#pragma warning(push)
+#pragma warning(disable:4514) // Unreferenced inline function has been removed
+	const std::vector<size_t>& GetPeaks() const { return peaks_; } // all the peaks decided so far
+	size_t GetLatency() const { return avgHalf_; } // envelope frames needed after the frame to decide it
+#pragma warning(pop)
+private:
+	void Decide(size_t frame);
+	float At(size_t frame) const;
+
+	const size_t maxLen_, avgHalf_, wait_;
+	const float delta_, range_;
+	const bool toBackTrack_;
+	bool isFlushed_;
+	const byte pad_[sizeof(intptr_t) - 2 * sizeof(bool)]{ 0 };
+
+	std::deque<float> hist_; // envelope values still needed, the first one is frame histFirst_
+	size_t histFirst_, nReceived_, nDecided_;
+	std::deque<size_t> maxFrames_, minFrames_; // decreasing values for running max, and local minimums
+	double sum_; // of the average window
+	float minVal_, maxVal_;
+
+	std::vector<size_t> peaks_;
+	size_t lastPeak_; // before back-tracking, for the minimum distance between peaks
+
+	OnsetPeakPicker(const OnsetPeakPicker&) = delete;
+	const OnsetPeakPicker& operator=(const OnsetPeakPicker&) = delete;
+};
\ No newline at end of file
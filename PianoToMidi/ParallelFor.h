@@ -0,0 +1,16 @@
+#pragma once
+
+// Calls func(i) for every i in [0, n) on at most hardware_concurrency threads, indices are handed out one by one,
+// so the first indices should be the most expensive. The first exception is re-thrown in the calling thread:
+template<class Func>
+void ParallelFor(const size_t n, const Func& func)
+{
+	std::atomic<size_t> next(0);
+	std::vector<std::future<void>> workers(std::min(static_cast<size_t>(
+		std::max(1u, std::thread::hardware_concurrency())), n));
+	for (auto& worker : workers) worker = std::async(std::launch::async, [&next, n, &func]()
+	{
+		for (auto i(next++); i < n; i = next++) func(i);
+	});
+	for (auto& worker : workers) worker.get();
+}
\ No newline at end of file
@@ -11,75 +11,185 @@
 
 #include "HarmonicPercussive.h"
 #include "Tempogram.h"
+#include "BeatTracker.h"
 
 #include "KerasRnn.h"
+#include "ProbabilityMap.h"
+#include "MidiWriter.h"
+#include "MemoryBudget.h"
+#include "ParallelFor.h"
+#include "SpillFile.h"
+
+#include "CqtStream.h"
+#include "HpssStream.h"
+#include "OnsetPeakPicker.h"
 
 using namespace std;
 using namespace juce;
 using fdeep::float_vec;
 
+struct PianoToMidi::RnnModels { unique_ptr<KerasRnn> onsets, offsets, frames, volumes; };
+
 struct PianoData
 {
 	shared_ptr<AudioLoader> song;
+	double audioSeconds;
 	shared_ptr<MelTransform> mel;
 	shared_ptr<ConstantQ> cqt;
 
 	shared_ptr<HarmonicPercussive> hpss;
 	float bpm;
-#ifdef _WIN64
-	const byte pad_[4]{ 0 };
-#endif
+	int melHop;
+	vector<pair<double, double>> tempoMap; // (seconds in the original audio, bpm)
 
-	unique_ptr<KerasRnn> onsets, offsets, frames, volumes;
-	float_vec melPadded, onsetProbs, offsetProbs, frameProbs, volumeProbs;
-	size_t nFrames, index;
+	shared_ptr<const PianoToMidi::RnnModels> models;
+	float_vec melPadded, chunkOnsets, chunkOffsets; // RNN input, and unquantized RNN outputs of the current chunk
+	ProbabilityMap onsetProbs, frameProbs, volumeProbs;
+	size_t nFrames, index, melPaddedFirst; // melPadded starts from this index of the mel spectrum
+	size_t nSpilledFrames; // probability frames of the windowed pipeline, they are not kept in memory
+	size_t sampleOffset, melOffset, cqtOffset; // trimmed silence from the beginning, in samples, mel- and cqt-frames
 
-	vector<array<int, 88>> pianoRoll;
+	NoteList notes;
 	vector<string> gamma;
 	string keySign;
 
-	PianoData() : bpm(0), nFrames(0), index(0) {}
+	MemoryBudget memory;
+
+	PianoData() : audioSeconds(0), bpm(0), melHop(0), nFrames(0), index(0), melPaddedFirst(0), nSpilledFrames(0),
+		sampleOffset(0), melOffset(0), cqtOffset(0) {}
 	~PianoData();
 
-	MidiMessage GetKeySignEvent() const;
+	pair<int, bool> GetKeySign() const; // (sharps or flats, minor)
+	vector<uint32_t> SecondsToTicks(const vector<double>& seconds, int ppqn) const;
+
+	static constexpr int ppqn = 480;
+	static constexpr float defaultBpm = 120; // tempo of MIDI files when audio is too short to estimate it
+	float MidiBpm() const { return bpm > 0 ? bpm : defaultBpm; }
+	vector<uint32_t> FrameTicks(int sampleRate, size_t nProbFrames) const;
+	vector<uint8_t> EncodeMidi(const NoteList& notesToWrite, const vector<uint32_t>& frameTicks) const;
+
+	size_t TrackedBytes() const;
+	// Frames per tile of a stage buffer, so that it fits under the memory budget together with other buffers of the stage,
+	// zero (no tiles) if the whole buffer fits:
+	size_t FramesTile(size_t nFrames, size_t bytesPerFrame, size_t otherBytes) const;
+	static constexpr size_t minFramesTile = 256;
+	const float* MelChunk(size_t chunk) const;
+	// Average tempo and tempo map, same for the whole-file and the windowed pipelines:
+	string Tempo(const vector<float>& onsetEnvelope, int sampleRate, int hopLength);
 private:
 	PianoData(const PianoData&) = delete;
 	const PianoData& operator=(const PianoData&) = delete;
 };
 PianoData::~PianoData() {} // 4710 Function not inlined
-MidiMessage PianoData::GetKeySignEvent() const
+vector<uint32_t> PianoData::SecondsToTicks(const vector<double>& seconds, const int ppqn) const
+{
+	// Pulses per second = ppqn * tempo / 60, times are in increasing order,
+	// so the tempo segments are summed in one forward pass, the first tempo is from the very beginning:
+	assert(is_sorted(seconds.cbegin(), seconds.cend()) and "Times should be in increasing order");
+	vector<uint32_t> result(seconds.size());
+	size_t segment(0);
+	double segStart(0), segTicks(0);
+	for (size_t i(0); i < seconds.size(); ++i)
+	{
+		if (tempoMap.empty())
+		{
+			result.at(i) = static_cast<uint32_t>(round(seconds.at(i) * ppqn * MidiBpm() / 60));
+			continue;
+		}
+		for (; segment + 1 < tempoMap.size() and tempoMap.at(segment + 1).first <= seconds.at(i); ++segment)
+		{
+			segTicks += (tempoMap.at(segment + 1).first - segStart) * ppqn * tempoMap.at(segment).second / 60;
+			segStart = tempoMap.at(segment + 1).first;
+		}
+		result.at(i) = static_cast<uint32_t>(round(segTicks
+			+ (seconds.at(i) - segStart) * ppqn * tempoMap.at(segment).second / 60));
+	}
+	return result;
+}
+vector<uint32_t> PianoData::FrameTicks(const int sampleRate, const size_t nProbFrames) const
+{
+	// Every note is at its absolute time in the original audio, before any silence has been trimmed,
+	// and tempo may change, so seconds of all the frames (and of the silent one at the end)
+	// are converted to ticks through the whole tempo map:
+	vector<double> frameSeconds(nProbFrames + 1);
+	for (size_t i(0); i < frameSeconds.size(); ++i) frameSeconds.at(i) = (static_cast<double>(sampleOffset)
+		+ (melOffset + i) * static_cast<double>(melHop)) / sampleRate;
+	return SecondsToTicks(frameSeconds, ppqn);
+}
+vector<uint8_t> PianoData::EncodeMidi(const NoteList& notesToWrite, const vector<uint32_t>& frameTicks) const
+{
+	MidiWriter midi(ppqn);
+	midi.AddText(1, "Automatically transcribed from audio");
+	midi.AddText(2, "Used Windows App created by Boris Shakhovsky");
+	midi.AddText(3, "Acoustic Grand Piano");
+	const auto sign(GetKeySign());
+	midi.AddKeySignature(sign.first, sign.second);
+
+	if (tempoMap.empty()) midi.AddTempo(MidiBpm());
+	else
+	{
+		vector<double> tempoSeconds(tempoMap.size()); // the first tempo is from the very beginning
+		for (size_t i(1); i < tempoSeconds.size(); ++i) tempoSeconds.at(i) = tempoMap.at(i).first;
+		const auto tempoTicks(SecondsToTicks(tempoSeconds, ppqn));
+		for (size_t i(0); i < tempoTicks.size(); ++i) midi.AddTempo(tempoMap.at(i).second, tempoTicks.at(i));
+	}
+	return midi.Encode(notesToWrite, frameTicks);
+}
+size_t PianoData::TrackedBytes() const
+{
+	auto result((melPadded.capacity() + chunkOnsets.capacity() + chunkOffsets.capacity()) * sizeof(float)
+		+ onsetProbs.size() + frameProbs.size() + volumeProbs.size()
+		+ notes.size() * (sizeof notes.start.front() + sizeof notes.end.front() + 2));
+	if (song) result += song->GetNumBytes();
+	if (mel) result += mel->GetMel()->capacity() * sizeof(float);
+	if (cqt) result += cqt->GetCQT()->capacity() * sizeof(float);
+	if (hpss) result += hpss->GetNumBytes();
+	return result;
+}
+size_t PianoData::FramesTile(const size_t nFrames, const size_t bytesPerFrame, const size_t otherBytes) const
+{
+	if (memory.Fits(TrackedBytes() + otherBytes + nFrames * bytesPerFrame)) return 0;
+	return min(max(memory.Headroom(TrackedBytes() + otherBytes) / bytesPerFrame, minFramesTile), nFrames);
+}
+const float* PianoData::MelChunk(const size_t chunk) const
+{
+	const auto pos(chunk * nFrames * PianoToMidi::nMels);
+	return pos >= melPaddedFirst ? melPadded.data() + static_cast<ptrdiff_t>(pos - melPaddedFirst)
+		: mel->GetMel()->data() + static_cast<ptrdiff_t>(pos);
+}
+pair<int, bool> PianoData::GetKeySign() const
 {
 	if (keySign == "C" or keySign == "Am")
-		return MidiMessage::keySignatureMetaEvent(0, keySign.back() == 'm');
+		return make_pair(0, keySign.back() == 'm');
 	else if (keySign == "G" or keySign == "Em")
-		return MidiMessage::keySignatureMetaEvent(1, keySign.back() == 'm');
+		return make_pair(1, keySign.back() == 'm');
 	else if (keySign == "D" or keySign == "Bm")
-		return MidiMessage::keySignatureMetaEvent(2, keySign.back() == 'm');
+		return make_pair(2, keySign.back() == 'm');
 	else if (keySign == "A" or keySign == "F#m")
-		return MidiMessage::keySignatureMetaEvent(3, keySign.back() == 'm');
+		return make_pair(3, keySign.back() == 'm');
 	else if (keySign == "E" or keySign == "C#m")
-		return MidiMessage::keySignatureMetaEvent(4, keySign.back() == 'm');
+		return make_pair(4, keySign.back() == 'm');
 	else if (keySign == "B" or keySign == "Abm")
-		return MidiMessage::keySignatureMetaEvent(5, keySign.back() == 'm');
+		return make_pair(5, keySign.back() == 'm');
 
 	else if (keySign == "F#" or keySign == "Ebm")
-		return MidiMessage::keySignatureMetaEvent(6, keySign.back() == 'm');
+		return make_pair(6, keySign.back() == 'm');
 
 	else if (keySign == "C#" or keySign == "Bbm")
-		return MidiMessage::keySignatureMetaEvent(-5, keySign.back() == 'm');
+		return make_pair(-5, keySign.back() == 'm');
 	else if (keySign == "Ab" or keySign == "Fm")
-		return MidiMessage::keySignatureMetaEvent(-4, keySign.back() == 'm');
+		return make_pair(-4, keySign.back() == 'm');
 	else if (keySign == "Eb" or keySign == "Cm")
-		return MidiMessage::keySignatureMetaEvent(-3, keySign.back() == 'm');
+		return make_pair(-3, keySign.back() == 'm');
 	else if (keySign == "Bb" or keySign == "Gm")
-		return MidiMessage::keySignatureMetaEvent(-2, keySign.back() == 'm');
+		return make_pair(-2, keySign.back() == 'm');
 	else if (keySign == "F" or keySign == "Dm")
-		return MidiMessage::keySignatureMetaEvent(-1, keySign.back() == 'm');
+		return make_pair(-1, keySign.back() == 'm');
 
 	else
 	{
 		assert("Not all key signatures checked");
-		return MidiMessage::keySignatureMetaEvent(0, false);
+		return make_pair(0, false);
 	}
 }
 
@@ -98,22 +208,35 @@ string PianoToMidi::FFmpegDecode(const char* mediaFile) const
 		<< "Bit_rate:\t\t" << data_->song->GetBitRate() << endl;
 
 	data_->song->Decode();
+	data_->audioSeconds = static_cast<double>(data_->song->GetNumSeconds());
 	os << "Duration:\t" << data_->song->GetNumSeconds() / 60 << " min : "
 		<< data_->song->GetNumSeconds() % 60 << " sec" << endl;
 	data_->song->MonoResample(rate);
+	data_->sampleOffset = data_->song->TrimSilence(hopLen);
+	os << "Silence trimmed:\t" << data_->sampleOffset / rate << " sec from beginning, "
+		<< data_->song->GetNumSeconds() << " sec left" << endl;
 
+	data_->memory.EndStage("Decoding", data_->TrackedBytes());
 	return move(os.str());
 }
 
 string PianoToMidi::MelSpectrum() const
 {
 	assert(not data_->mel and "Mel transform calculated twice");
-	data_->mel = make_unique<MelTransform>(data_->song, rate, nMels, fMin, fMax, htk);
-
-	SpecPostProc::TrimSilence(data_->mel->GetMel().get(), nMels);
-	SpecPostProc::Power2db(data_->mel->GetMel().get());
+	// Complex STFT and its magnitudes are the largest buffers of the stage, so under memory budget they are tiled:
+	const size_t nFft(2'048), nFrames(data_->song->GetNumSamples() / static_cast<size_t>(hopLen) + 1);
+	const auto framesTile(data_->FramesTile(nFrames, (nFft / 2 + 1) * (sizeof(complex<float>) + sizeof(float)),
+		nFrames * nMels * sizeof(float)));
+	data_->mel = make_unique<MelTransform>(data_->song, rate, nMels, fMin, fMax, htk,
+		true, nFft, hopLen, WIN_FUNC::HANN, PAD_MODE::MIRROR, 2.f, framesTile);
+	data_->memory.Track(data_->TrackedBytes() + (framesTile ? framesTile : nFrames) * (nFft / 2 + 1)
+		* (sizeof(complex<float>) + sizeof(float)));
+
+	data_->melOffset = SpecPostProc::Spectrum2db(data_->mel->GetMel().get(), nMels, false);
+	data_->melHop = data_->mel->GetHopLen();
 
 	data_->mel->CalcOctaveIndices();
+	data_->memory.EndStage("Mel spectrum", data_->TrackedBytes());
 
 	return data_->mel->GetLog() + "Log mel-scaled spectrogram calculated";
 }
@@ -124,22 +247,26 @@ string PianoToMidi::CqtTotal() const
 	
 //	if (data_->song->GetBytesPerSample() == sizeof(uint16_t)) data_->song->MonoResample(0);
 	assert(data_->song->GetBytesPerSample() == sizeof(float) and "Wrong raw audio data format");
-	data_->cqt = make_shared<ConstantQ>(data_->song, 88 * nCqtBins, 12 * nCqtBins);
-
+	// Audio is decimated in place, while octave signals are copied, at most twice the original audio in total,
+	// and if they do not fit under memory budget, octaves are calculated one after another without the copies:
+	const auto songBytes(data_->song->GetNumBytes()), cqtBytes((data_->song->GetNumSamples() / static_cast<size_t>(hopLen) + 1) * 88 * nCqtBins * sizeof(float));
+	const auto concurrent(data_->memory.Fits(data_->TrackedBytes() + cqtBytes + 2 * songBytes));
+	data_->cqt = make_shared<ConstantQ>(data_->song, 88 * nCqtBins, 12 * nCqtBins, 27.5f, hopLen,
+		1.f, NORM_TYPE::L1, .01f, ConstantQ::CQT_WINDOW::HANN, true, PAD_MODE::MIRROR, concurrent);
+	data_->memory.Track(data_->TrackedBytes() + (concurrent ? 2 * songBytes : 0));
 	data_->song.reset();
 
 	ostringstream os;
 	os << "Constant-Q spectrogram calculated" << endl << endl;
 
-	SpecPostProc::Amplitude2power(data_->cqt->GetCQT().get());
-	SpecPostProc::TrimSilence(data_->cqt->GetCQT().get(), data_->cqt->GetNumBins());
-	SpecPostProc::Power2db(data_->cqt->GetCQT().get(), *min_element(data_->cqt->GetCQT()->cbegin(), data_->cqt->GetCQT()->cend()));
+	data_->cqtOffset = SpecPostProc::Spectrum2db(data_->cqt->GetCQT().get(), data_->cqt->GetNumBins(), true, true);
 
 	assert(data_->cqt->GetCQT()->size() % data_->cqt->GetNumBins() == 0
 		and "Constant-Q spectrum is not rectangular");
 
 	os << "MIDI duration:\t" << GetMidiSeconds() / 60 << " min : "
 		<< GetMidiSeconds() % 60 << " sec";
+	data_->memory.EndStage("Constant-Q", data_->TrackedBytes());
 	return move(os.str());
 }
 
@@ -169,12 +296,20 @@ string PianoToMidi::HarmPerc() const
 	assert(data_->keySign.empty() and "Either HarmPerc called twice, or order is wrong");
 
 	data_->hpss = make_shared<HarmonicPercussive>(data_->cqt);
-
-	data_->hpss->OnsetEnvelope();
+	data_->memory.Track(data_->TrackedBytes());
+
+	// Onset envelope copies the percussive spectrum twice (the frames and their references), tiled under memory budget:
+	const auto nFrames(data_->cqt->GetCQT()->size() / data_->cqt->GetNumBins()),
+		framesTile(data_->FramesTile(nFrames, 2 * data_->cqt->GetNumBins() * sizeof(float), 0));
+	data_->hpss->OnsetEnvelope(1, 1, false, true, AGGREGATE::MEAN, framesTile);
+	data_->memory.Track(data_->TrackedBytes() + 2 * (framesTile ? framesTile : nFrames) * data_->cqt->GetNumBins() * sizeof(float));
+	data_->hpss->ReleasePercussive();
 	data_->hpss->OnsetPeaksDetect();
 
 	data_->hpss->Chromagram(false);
+	data_->hpss->ReleaseHarmonic();
 	data_->hpss->ChromaSum();
+	data_->memory.EndStage("Harmonic-percussive", data_->TrackedBytes());
 
 	data_->keySign = data_->hpss->KeySignature();
 	ostringstream os;
@@ -187,19 +322,36 @@ string PianoToMidi::Tempo() const
 		and "HarmPerc should be called before Tempo");
 	assert(data_->bpm == 0 and "Tempo called twice");
 
+	return data_->Tempo(data_->hpss->GetOnsetEnvelope(), data_->cqt->GetSampleRate(), data_->cqt->GetHopLength());
+}
+string PianoData::Tempo(const vector<float>& oEnv, const int sampleRate, const int hopLength)
+{
 	Tempogram tempo;
-//	data_->bpm = 0;
-	data_->bpm = tempo.MostProbableTempo(data_->hpss->GetOnsetEnvelope(),
-		data_->cqt->GetSampleRate(), data_->cqt->GetHopLength());
+//	bpm = 0;
+	bpm = tempo.MostProbableTempo(oEnv, sampleRate, hopLength);
 
 	ostringstream os;
 	os << "Average tempo:\t";
-	if (data_->bpm) os << round(data_->bpm);
+	if (bpm) os << round(bpm);
 	else
 	{
 		os << "don't know, audio is too short";
-//		data_->bpm = 120;
+//		bpm = 120;
+		return move(os.str());
 	}
+
+	// Beats may drift from the average tempo, so lower tightness than default:
+	const auto mean(accumulate(oEnv.cbegin(), oEnv.cend(), 0.) / oEnv.size());
+	const auto stdDev(sqrt(accumulate(oEnv.cbegin(), oEnv.cend(), 0., [mean](double sum, float val)
+		{ return sum + (val - mean) * (val - mean); }) / max(oEnv.size() - 1, static_cast<size_t>(1))));
+	BeatTracker beats(sampleRate, hopLength, bpm, 20, static_cast<float>(stdDev));
+	beats.Push(oEnv.data(), oEnv.size());
+	beats.Flush();
+	tempoMap = beats.TempoMap();
+	for (auto iter(tempoMap.begin() + (tempoMap.empty() ? 0 : 1)); iter != tempoMap.end(); ++iter)
+		iter->first += (sampleOffset + cqtOffset * static_cast<double>(hopLength))
+			/ sampleRate; // Onset envelope starts after trimmed silence
+	if (tempoMap.size() > 1) os << ", " << tempoMap.size() - 1 << " tempo changes";
 	return move(os.str());
 }
 
@@ -210,171 +362,168 @@ string PianoToMidi::KerasLoad(const string& path) const
 	data_->hpss.reset();
 
 //	assert(data_->bpm and "Tempo should be called before KerasLoad");
-	assert(not data_->onsets and not data_->offsets and not data_->frames and not data_->volumes and "KerasLoad called twice");
-
-	assert(data_->nFrames == 0 and "Number of frames calculated twice");
+	assert(data_->nFrames == 0 and "KerasLoad called twice");
 	data_->nFrames = static_cast<size_t>(nSeconds) * rate / data_->mel->GetHopLen() + 1;
-	data_->melPadded.resize(((data_->mel->GetMel()->size() / nMels - 1) / data_->nFrames + 1) * data_->nFrames * nMels);
-	copy(data_->mel->GetMel()->cbegin(), data_->mel->GetMel()->cend(), data_->melPadded.begin());
-	fill(data_->melPadded.begin() + static_cast<ptrdiff_t>(data_->mel->GetMel()->size()), data_->melPadded.end(), *min_element(data_->mel->GetMel()->cbegin(), data_->mel->GetMel()->cend()));
+	const auto nChunks((data_->mel->GetMel()->size() / nMels - 1) / data_->nFrames + 1),
+		paddedSize(nChunks * data_->nFrames * nMels);
+
+	// Under memory budget, RNNs read the mel spectrum in place, and only the last chunk is padded,
+	// and if even that does not fit, constant-Q spectrum is released (it is only needed to be displayed):
+	const auto mapBytes(3 * nChunks * data_->nFrames * 88 + 2 * data_->nFrames * 88 * sizeof(float));
+	if (not data_->memory.Fits(data_->TrackedBytes() + mapBytes + paddedSize * sizeof(float)))
+		data_->melPaddedFirst = (nChunks - 1) * data_->nFrames * nMels;
+	if (not data_->memory.Fits(data_->TrackedBytes() + mapBytes + (paddedSize - data_->melPaddedFirst) * sizeof(float)))
+	{
+		data_->cqt->GetCQT()->clear();
+		data_->cqt->GetCQT()->shrink_to_fit();
+	}
+	data_->melPadded.resize(paddedSize - data_->melPaddedFirst);
+	copy(data_->mel->GetMel()->cbegin() + static_cast<ptrdiff_t>(data_->melPaddedFirst), data_->mel->GetMel()->cend(), data_->melPadded.begin());
+	fill(data_->melPadded.begin() + static_cast<ptrdiff_t>(data_->mel->GetMel()->size() - data_->melPaddedFirst), data_->melPadded.end(), *min_element(data_->mel->GetMel()->cbegin(), data_->mel->GetMel()->cend()));
 
-#ifdef _DEBUG
-	UNREFERENCED_PARAMETER(path);
-#elif defined NDEBUG
-	data_->onsets	= make_unique<KerasRnn>(path + "\\" + onsetsModel);
-	data_->offsets	= make_unique<KerasRnn>(path + "\\" + offsetsModel);
-	data_->frames	= make_unique<KerasRnn>(path + "\\" + framesModel);
-	data_->volumes	= make_unique<KerasRnn>(path + "\\" + volumesModel);
-#else
-#pragma error Not debug, not release, then what is it?
-#endif
+	auto result(EnsureModels(path));
 
-	data_->onsetProbs .resize(data_->melPadded.size() / nMels * 88);
-	data_->offsetProbs.resize(data_->melPadded.size() / nMels * 88);
-	data_->frameProbs .resize(data_->melPadded.size() / nMels * 88);
-	data_->volumeProbs.resize(data_->melPadded.size() / nMels * 88);
+	data_->onsetProbs .resize(nChunks * data_->nFrames * 88);
+	data_->frameProbs .resize(nChunks * data_->nFrames * 88);
+	data_->volumeProbs.resize(nChunks * data_->nFrames * 88);
 //	data_->index = 0;
+	data_->memory.EndStage("RNN models", data_->TrackedBytes());
 
+	return move(result);
+}
+shared_ptr<const PianoToMidi::RnnModels> PianoToMidi::LoadModels(const string& path, string* log)
+{
+	const auto result(make_shared<RnnModels>());
 #ifdef _DEBUG
-	return "";
+	UNREFERENCED_PARAMETER(path);
+	if (log) log->clear();
 #elif defined NDEBUG
-	return move(data_->onsets->GetLog() + data_->offsets->GetLog() + data_->frames->GetLog() + data_->volumes->GetLog());
+	// Joined with the separator of the platform:
+	const auto Model([&path](const char* model) { return (boost::filesystem::path(path) / model).string(); });
+	result->onsets	= make_unique<KerasRnn>(Model(onsetsModel));
+	result->offsets	= make_unique<KerasRnn>(Model(offsetsModel));
+	result->frames	= make_unique<KerasRnn>(Model(framesModel));
+	result->volumes	= make_unique<KerasRnn>(Model(volumesModel));
+	if (log) *log = result->onsets->GetLog() + result->offsets->GetLog() + result->frames->GetLog() + result->volumes->GetLog();
 #else
 #pragma error Not debug, not release, then what is it?
 #endif
+	return result;
+}
+void PianoToMidi::UseModels(const shared_ptr<const RnnModels>& models) const
+{
+	assert(models and "Models should be loaded before they are shared");
+	data_->models = models;
+}
+string PianoToMidi::EnsureModels(const string& path) const
+{
+	if (data_->models) return "";
+	string result;
+	data_->models = LoadModels(path, &result);
+	return move(result);
 }
-WPARAM PianoToMidi::RnnProbabs() const
+size_t PianoToMidi::RnnProbabs() const
 {
 //	assert(data_->onsets and data_->offsets and data_->frames and data_->volumes and "KerasLoad should be called before RnnProbabs");
 
 	if (data_->index / 4 <= (data_->onsetProbs.size() - 1) / data_->nFrames / 88)
 	{
+		Predict(data_->index % 4, data_->MelChunk(data_->index / 4), data_->index / 4 * data_->nFrames * 88);
+		const auto percent(100 * ++data_->index / 4 / ((data_->onsetProbs.size() - 1) / data_->nFrames / 88 + 1));
+		if (percent >= 100) data_->memory.EndStage("RNN inference", data_->TrackedBytes());
+		return percent;
+	}
+	return 100;
+}
+void PianoToMidi::Predict(const size_t model, const float* melChunk, const size_t pos) const
+{
 #ifdef _DEBUG
-		for (size_t i(0); i < data_->nFrames * 88; ++i)
-		{
-			data_-> onsetProbs.at(i + data_->index / 4 * data_->nFrames * 88) = static_cast<float>(.501 * rand() / RAND_MAX);
-			data_->offsetProbs.at(i + data_->index / 4 * data_->nFrames * 88) = static_cast<float>(.501 * rand() / RAND_MAX);
-			data_-> frameProbs.at(i + data_->index / 4 * data_->nFrames * 88) = static_cast<float>(.501 * rand() / RAND_MAX);
-			data_->volumeProbs.at(i + data_->index / 4 * data_->nFrames * 88) = static_cast<float>(.501 * rand() / RAND_MAX);
-		}
-		Sleep(500);
+	UNREFERENCED_PARAMETER(model);
+	UNREFERENCED_PARAMETER(melChunk);
+	for (size_t i(0); i < data_->nFrames * 88; ++i)
+	{
+		data_-> onsetProbs.data()[pos + i] = ProbabilityMap::Quantize(static_cast<float>(.501 * rand() / RAND_MAX));
+		data_-> frameProbs.data()[pos + i] = ProbabilityMap::Quantize(static_cast<float>(.501 * rand() / RAND_MAX));
+		data_->volumeProbs.data()[pos + i] = ProbabilityMap::Quantize(static_cast<float>(.501 * rand() / RAND_MAX));
+	}
+	Sleep(500);
 #elif defined NDEBUG
-		switch (data_->index % 4)
-		{
-		case 0:
-		{
-			const auto onProb(data_->onsets->Predict2D(data_->melPadded.data() + static_cast<ptrdiff_t>(data_->index / 4 * data_->nFrames * nMels), data_->nFrames, nMels));
-			copy(onProb.cbegin(), onProb.cend(), data_->onsetProbs.begin() + static_cast<ptrdiff_t>(data_->index / 4 * data_->nFrames * 88));
-		} break;
-		case 1:
-		{
-			const auto offProb(data_->offsets->Predict2D(data_->melPadded.data() + static_cast<ptrdiff_t>(data_->index / 4 * data_->nFrames * nMels), data_->nFrames, nMels));
-			copy(offProb.cbegin(), offProb.cend(), data_->offsetProbs.begin() + static_cast<ptrdiff_t>(data_->index / 4 * data_->nFrames * 88));
-		} break;
-		case 2:
-		{
-			const auto frProb(data_->frames->PredictMulti(data_->melPadded.data() + static_cast<ptrdiff_t>(data_->index / 4 * data_->nFrames * nMels), data_->nFrames, nMels,
-				data_->onsetProbs.data() + static_cast<ptrdiff_t>(data_->index / 4 * data_->nFrames * 88),
-				data_->offsetProbs.data() + static_cast<ptrdiff_t>(data_->index / 4 * data_->nFrames * 88), 88));
-			copy(frProb.cbegin(), frProb.cend(), data_->frameProbs.begin() + static_cast<ptrdiff_t>(data_->index / 4 * data_->nFrames * 88));
-		} break;
-		case 3:
-		{
-			const auto volProb(data_->volumes->Predict2D(data_->melPadded.data() + static_cast<ptrdiff_t>(data_->index / 4 * data_->nFrames * nMels), data_->nFrames, nMels));
-			copy(volProb.cbegin(), volProb.cend(), data_->volumeProbs.begin() + static_cast<ptrdiff_t>(data_->index / 4 * data_->nFrames * 88));
-		} break;
-		default: assert(not "Remainder of division operation is somehow wrong");
-		}
+	// Frames RNN needs onsets and offsets of its chunk as floats, so only they are kept unquantized:
+	switch (model)
+	{
+	case 0:
+		data_->chunkOnsets = data_->models->onsets->Predict2D(melChunk, data_->nFrames, nMels);
+		data_->onsetProbs.Assign(pos, data_->chunkOnsets.data(), data_->chunkOnsets.size());
+		break;
+	case 1:
+		data_->chunkOffsets = data_->models->offsets->Predict2D(melChunk, data_->nFrames, nMels);
+		break;
+	case 2:
+	{
+		const auto frProb(data_->models->frames->PredictMulti(melChunk, data_->nFrames, nMels,
+			data_->chunkOnsets.data(), data_->chunkOffsets.data(), 88));
+		data_->frameProbs.Assign(pos, frProb.data(), frProb.size());
+	} break;
+	case 3:
+	{
+		const auto volProb(data_->models->volumes->Predict2D(melChunk, data_->nFrames, nMels));
+		data_->volumeProbs.Assign(pos, volProb.data(), volProb.size());
+	} break;
+	default: assert(not "Remainder of division operation is somehow wrong");
+	}
 #else
 #pragma error Not debug, not release, then what is it?
 #endif
-		return 100 * ++data_->index / 4 / ((data_->onsetProbs.size() - 1) / data_->nFrames / 88 + 1);
-	}
-	return 100;
 }
 
-const float_vec& PianoToMidi::GetOnsets() const { return data_->onsetProbs; }
-const float_vec& PianoToMidi::GetActives() const { return data_->frameProbs; }
+const ProbabilityMap& PianoToMidi::GetOnsets() const { return data_->onsetProbs; }
+const ProbabilityMap& PianoToMidi::GetActives() const { return data_->frameProbs; }
 const array<size_t, 8>& PianoToMidi::GetMelOctaves() const { return data_->mel->GetOctaveIndices(); }
 const array<size_t, 88>& PianoToMidi::GetMelNoteIndices() const { return data_->mel->GetNoteIndices(); }
 
-vector<tuple<size_t, size_t, size_t, int>> PianoToMidi::CalcNoteIntervals() const
+NoteList PianoToMidi::CalcNoteIntervals() const
 {
-	// Ensure that any frame with an onset prediction is considered active:
-	transform(data_->onsetProbs.cbegin(), data_->onsetProbs.cend(), data_->frameProbs.cbegin(),
-		data_->frameProbs.begin(), [](const float on, const float fr) { return (on > .5 or fr > .5) ? 1.f : 0.f; });
-
-	vector<tuple<size_t, size_t, size_t, int>> result;
-
-	array<int, 88> starts;
-	fill(starts.begin(), starts.end(), -1);
-
-	const auto EndPitch([this, &result, &starts](size_t pitch, size_t endFrame)
-		{
-			result.emplace_back(make_tuple(pitch, starts.at(pitch), endFrame, static_cast<int>(data_->volumeProbs.at(starts.at(pitch) *
-#ifdef _WIN64
-				88ull
-#else
-				88ul
-#endif
-				+ pitch) * 80 + 10)));
-			starts.at(pitch) = -1;
-		});
-
-	// Add silent frame at the end so we can do a final loop and terminate any notes that are still active:
-	data_->frameProbs.resize(data_->frameProbs.size() + starts.size());
-	fill(data_->frameProbs.end() - static_cast<ptrdiff_t>(starts.size()), data_->frameProbs.end(), 0);
-	for (size_t i(0); i < data_->frameProbs.size() / starts.size(); ++i) for (size_t pitch(0); pitch < starts.size(); ++pitch)
-		if (data_->frameProbs.at(i * starts.size() + pitch))
-		{
-			if (starts.at(pitch) == -1)
-			{
-				if (data_->onsetProbs.at(i * starts.size() + pitch) > .5) starts.at(pitch) = static_cast<int>(i); // Start a note only if we have predicted an onset
-				// else; // Even though the frame is active, there is no onset, so ignore it
-			}
-			else if (data_->onsetProbs.at(i * starts.size() + pitch) > .5 and data_->onsetProbs.at((i - 1) * starts.size() + pitch) < .5)
-			{
-				EndPitch(pitch, i);						// Pitch is already active, but because of a new onset, we should end the note
-				starts.at(pitch) = static_cast<int>(i);	// and start a new one
-			}
-		}
-		else if (starts.at(pitch) != -1) EndPitch(pitch, i);
-
-	assert(data_->offsetProbs.empty() and "Offsets should have already been released");
-	data_->volumeProbs.clear();
+	// Probabilities are thresholded into bit masks, so they are kept for decoding again with other settings:
+	auto result(NoteIntervals::Extract(data_->onsetProbs.data(), data_->frameProbs.data(),
+		data_->volumeProbs.data(), data_->frameProbs.size() / 88));
 
-	data_->pianoRoll.resize(data_->frameProbs.size() / starts.size());
-	return /*move(*/result;
+	assert(data_->chunkOffsets.empty() and "Offsets should have already been released");
+	return result;
 }
 string PianoToMidi::Gamma() const
 {
-	data_->onsets.reset();
-	data_->offsets.reset();
-	data_->frames.reset();
-	data_->volumes.reset();
+	data_->models.reset(); // shared models stay loaded for the other objects
 	data_->melPadded.clear();
+	data_->melPadded.shrink_to_fit();
 
 	data_-> onsetProbs.resize(data_->mel->GetMel()->size() / nMels * 88);
-	data_->offsetProbs.clear();
+	data_->chunkOnsets.clear();
+	data_->chunkOnsets.shrink_to_fit();
+	data_->chunkOffsets.clear();
+	data_->chunkOffsets.shrink_to_fit();
 	data_-> frameProbs.resize(data_->mel->GetMel()->size() / nMels * 88);
 	data_->volumeProbs.resize(data_->mel->GetMel()->size() / nMels * 88);
 
 	if (data_->index % 4 or data_->index / 4 != (data_->onsetProbs.size() - 1) / data_->nFrames / 88 + 1)
 		throw KerasError("RnnProbabs called wrong number of times");
-	assert(data_->pianoRoll.empty() and data_->gamma.empty() and "Gamma called twice");
+	assert(data_->notes.size() == 0 and data_->gamma.empty() and "Gamma called twice");
 
+	data_->notes = CalcNoteIntervals();
+	CalcGamma();
+
+	data_->memory.EndStage("Notes", data_->TrackedBytes());
+	ostringstream os;
+	os << "Scale:\t\t";
+	for (const auto& n : data_->gamma) os << n << ' ';
+	return move(os.str());
+}
+void PianoToMidi::CalcGamma() const
+{
 	array<pair<int, string>, 12> notesCount;
 	for (size_t i(0); i < notesCount.size(); ++i) notesCount.at(i).second = vector<string>{
 		"A", "Bb", "B", "C", "C#", "D", "Eb", "E", "F", "F#", "G", "Ab" }.at(i);
 
-	assert(data_->pianoRoll.empty() and "Gamma have been called twice");
-	const auto intervals(CalcNoteIntervals());
-	for (const auto& n : intervals)
-	{
-		data_->pianoRoll.at(get<1>(n)).at(get<0>(n)) = get<3>(n);
-		data_->pianoRoll.at(get<2>(n)).at(get<0>(n)) = -1;
-		++notesCount.at(get<0>(n) % notesCount.size()).first;
-	}
+	for (const auto p : data_->notes.pitch) ++notesCount.at(p % notesCount.size()).first;
 	sort(notesCount.rbegin(), notesCount.rend());
 
 	data_->gamma.resize(7);
@@ -382,16 +531,10 @@ string PianoToMidi::Gamma() const
 		+ static_cast<ptrdiff_t>(data_->gamma.size()), data_->gamma.begin(),
 #pragma warning(suppress:4710) // Function not inlined
 		[](const pair<int, string>& val) { return val.second; }));
-
-	ostringstream os;
-	os << "Scale:\t\t";
-	for (const auto& n : data_->gamma) os << n << ' ';
-	return move(os.str());
 }
 string PianoToMidi::KeySignature() const
 {
-	assert(not data_->pianoRoll.empty() and not data_->gamma.empty()
-		and "Gamma should be called before KeySignature");
+	assert(not data_->gamma.empty() and "Gamma should be called before KeySignature");
 
 	vector<string> blacks;
 	for (const auto& n : data_->gamma) if (n.length() > 1) blacks.emplace_back(n);
@@ -482,63 +625,358 @@ string PianoToMidi::KeySignature() const
 	return "Key signature:\t" + (keySign.empty() ? "The scale does not correspond to any" : keySign);
 }
 
-void PianoToMidi::WriteMidi(LPCTSTR midiFile, string fileA) const
+void WriteBytes(const File& outputFile, const vector<uint8_t>& bytes, const string& fileA)
 {
-	using placeholders::_1;
 	using boost::filesystem::exists;
 
-	assert(not data_->pianoRoll.empty() and "Gamma should be called before WriteMidi");
-//	assert(data_->pianoRoll.size() == data_->hpss->GetOnsetPeaks().size() and "Wrong number of note onsets");
-
-	const auto outputFile(File::getCurrentWorkingDirectory().getChildFile(String(midiFile)));
 	if (exists(outputFile.getFullPathName().toStdString()) and not outputFile.deleteFile())
 		throw MidiOutError(("Could not delete MIDI file: " + fileA).c_str());
 	FileOutputStream outputStream(outputFile.getFullPathName());
 	if (outputStream.failedToOpen())
 		throw MidiOutError(("Could not open MIDI file: " + fileA).c_str());
+	if (not outputStream.write(bytes.data(), bytes.size()))
+		throw MidiOutError(("Could not write to MIDI file: " + fileA).c_str());
+}
+
+void PianoToMidi::WriteMidi(const wchar_t* midiFile, string fileA) const
+{
+	assert(not data_->gamma.empty() and "Gamma should be called before WriteMidi");
+	if (data_->notes.size() == 0) throw MidiOutError("There are no notes, nothing to write to MIDI");
+
+	WriteBytes(File::getCurrentWorkingDirectory().getChildFile(String(midiFile)),
+		data_->EncodeMidi(data_->notes, data_->FrameTicks(rate, data_->frameProbs.size() / 88)), fileA);
+}
 
-	MidiMessageSequence track;
-	track.addEvent(MidiMessage::textMetaEvent(1, "Automatically transcribed from audio"));
-	track.addEvent(MidiMessage::textMetaEvent(2, "Used Windows App created by Boris Shakhovsky"));
-	track.addEvent(MidiMessage::textMetaEvent(3, "Acoustic Grand Piano"));
-	track.addEvent(data_->GetKeySignEvent());
-
-	MidiFile midi;
-	constexpr auto ppqn(480);
-	midi.setTicksPerQuarterNote(ppqn);
-	const auto tempoEvent(MidiMessage::tempoMetaEvent(
-		static_cast<int>(round(1'000'000 * 60 / data_->bpm))));
-
-	assert(not data_->pianoRoll.empty() and "Piano roll should be called before WriteMidi");
-	size_t iRight(data_->pianoRoll.size() - 1);
-	for (; iRight and all_of(data_->pianoRoll.at(iRight).cbegin(), data_->pianoRoll.at(iRight).cend(), bind(equal_to<int>(), 0, _1)); --iRight);
-	if (iRight == 0) throw MidiOutError("There are no notes, nothing to write to MIDI");
-
-	for (size_t j(0); j < data_->pianoRoll.at(iRight).size(); ++j)
-		if (data_->pianoRoll.at(iRight).at(j) > 0) track.addEvent(MidiMessage::noteOn(1, static_cast<int>(j) + 21, static_cast<uint8>(data_->pianoRoll.at(iRight).at(j))));
-		else if (data_->pianoRoll.at(iRight).at(j) == -1) track.addEvent(MidiMessage::noteOff(1, static_cast<int>(j) + 21));
-		else assert(data_->pianoRoll.at(iRight).at(j) == 0 and "Wrong piano roll value");
-
-	for (size_t i(iRight); i; --i)
+string PianoToMidi::Decode(const DecodeParams& params) const
+{
+	assert(not data_->gamma.empty() and "Gamma or LoadProbabs should be called before Decode");
+	data_->notes = NoteIntervals::Extract(data_->onsetProbs.data(), data_->frameProbs.data(),
+		data_->volumeProbs.data(), data_->frameProbs.size() / 88, params);
+	return "Notes decoded:\t" + to_string(data_->notes.size());
+}
+void PianoToMidi::DecodeSweep(const vector<pair<DecodeParams, string>>& paramsAndMidiFiles) const
+{
+	assert(not data_->gamma.empty() and "Gamma or LoadProbabs should be called before DecodeSweep");
+
+	// Probabilities and tempo map are only read, so every setting is decoded and written on its own thread:
+	// Two settings writing the same file would race, so the paths are checked before any decoding:
+	vector<File> midiFiles;
+	for (const auto& paramsAndFile : paramsAndMidiFiles)
 	{
-		if (all_of(data_->pianoRoll.at(i - 1).cbegin(), data_->pianoRoll.at(i - 1).cend(), bind(equal_to<int>(), 0, _1))) continue;
-
-		track.addTimeToMessages((iRight - i + 1.) // delta frame
-			* data_->mel->GetHopLen() / rate // delta frame to delta seconds
-			// multiply by pulses per seconds (ppqn * tempo / 60):
-			/ tempoEvent.getTempoMetaEventTickLength(midi.getTimeFormat()));
-		for (size_t j(0); j < data_->pianoRoll.at(i - 1).size(); ++j)
-			if (data_->pianoRoll.at(i - 1).at(j) > 0) track.addEvent(MidiMessage::noteOn(1, static_cast<int>(j) + 21, static_cast<uint8>(data_->pianoRoll.at(i - 1).at(j))));
-			else if (data_->pianoRoll.at(i - 1).at(j) == -1) track.addEvent(MidiMessage::noteOff(1, static_cast<int>(j) + 21));
-			else assert(data_->pianoRoll.at(i - 1).at(j) == 0 and "Wrong piano roll value");
-
-		iRight = i - 1;
+		const auto file(File::getCurrentWorkingDirectory().getChildFile(String::fromUTF8(paramsAndFile.second.c_str())));
+		if (find(midiFiles.cbegin(), midiFiles.cend(), file) != midiFiles.cend())
+			throw MidiOutError(("The same MIDI file is given for two settings: " + paramsAndFile.second).c_str());
+		midiFiles.push_back(file);
 	}
-	track.addEvent(tempoEvent);
-	track.updateMatchedPairs();
 
-	midi.addTrack(track);
-	data_->pianoRoll.clear();
-	if (not midi.writeTo(outputStream))
-		throw MidiOutError(("Could not write to MIDI file: " + fileA).c_str());
+	const auto frameTicks(data_->FrameTicks(rate, data_->frameProbs.size() / 88));
+	ParallelFor(paramsAndMidiFiles.size(), [this, &paramsAndMidiFiles, &midiFiles, &frameTicks](const size_t i)
+	{
+		const auto& fileA(paramsAndMidiFiles.at(i).second);
+		const auto notes(NoteIntervals::Extract(data_->onsetProbs.data(), data_->frameProbs.data(),
+			data_->volumeProbs.data(), data_->frameProbs.size() / 88, paramsAndMidiFiles.at(i).first));
+		if (notes.size() == 0) throw MidiOutError(("There are no notes, nothing to write to MIDI: " + fileA).c_str());
+		WriteBytes(midiFiles.at(i), data_->EncodeMidi(notes, frameTicks), fileA);
+	});
+}
+
+void PianoToMidi::SaveProbabs(const wchar_t* probsFile, const string& fileA) const
+{
+	assert(not data_->gamma.empty() and "Gamma should be called before SaveProbabs");
+
+	// Everything the decoding needs: timing, tempo, scale, key, and the probabilities themselves
+	const auto file(File::getCurrentWorkingDirectory().getChildFile(String(probsFile)));
+	if (file.existsAsFile() and not file.deleteFile())
+		throw KerasError(("Could not delete probabilities file: " + fileA).c_str());
+	FileOutputStream stream(file);
+	if (stream.failedToOpen()) throw KerasError(("Could not open probabilities file: " + fileA).c_str());
+
+	auto isWritten(stream.writeInt(probsMagic) and stream.writeInt(data_->melHop)
+		and stream.writeInt64(static_cast<int64>(data_->sampleOffset))
+		and stream.writeInt64(static_cast<int64>(data_->melOffset)) and stream.writeFloat(data_->bpm)
+		and stream.writeInt64(static_cast<int64>(data_->tempoMap.size())));
+	for (const auto& tempo : data_->tempoMap)
+		isWritten = isWritten and stream.writeDouble(tempo.first) and stream.writeDouble(tempo.second);
+	isWritten = isWritten and stream.writeString(String(data_->keySign))
+		and stream.writeInt64(static_cast<int64>(data_->gamma.size()));
+	for (const auto& note : data_->gamma) isWritten = isWritten and stream.writeString(String(note));
+	isWritten = isWritten and stream.writeInt64(static_cast<int64>(data_->frameProbs.size()));
+	for (const auto& probs : { cref(data_->onsetProbs), cref(data_->frameProbs), cref(data_->volumeProbs) })
+		isWritten = isWritten and stream.write(probs.get().data(), probs.get().size());
+	stream.flush();
+	if (not isWritten or stream.getStatus().failed())
+		throw KerasError(("Could not write to probabilities file: " + fileA).c_str());
+}
+string PianoToMidi::LoadProbabs(const wchar_t* probsFile, const string& fileA) const
+{
+	assert(not data_->song and data_->gamma.empty() and "LoadProbabs should be called instead of the whole pipeline");
+
+	FileInputStream stream(File::getCurrentWorkingDirectory().getChildFile(String(probsFile)));
+	if (stream.failedToOpen()) throw KerasError(("Could not open probabilities file: " + fileA).c_str());
+	const auto Fail([&fileA]() { throw KerasError(("Wrong probabilities file: " + fileA).c_str()); });
+	const auto ReadSize([&stream, &Fail]()
+	{
+		const auto result(stream.readInt64());
+		if (result < 0 or result > stream.getNumBytesRemaining()) Fail();
+		return static_cast<size_t>(result);
+	});
+
+	if (stream.readInt() != probsMagic) Fail();
+	data_->melHop = stream.readInt();
+	data_->sampleOffset = static_cast<size_t>(stream.readInt64());
+	data_->melOffset = static_cast<size_t>(stream.readInt64());
+	data_->bpm = stream.readFloat(); // zero if audio was too short for the tempo, the default one is written then
+	data_->tempoMap.resize(ReadSize());
+	for (auto& tempo : data_->tempoMap)
+	{
+		tempo.first = stream.readDouble();
+		tempo.second = stream.readDouble();
+	}
+	data_->keySign = stream.readString().toStdString();
+	data_->gamma.resize(ReadSize());
+	for (auto& note : data_->gamma) note = stream.readString().toStdString();
+
+	const auto nProbs(ReadSize());
+	if (data_->melHop <= 0 or not isfinite(data_->bpm) or data_->bpm < 0 or nProbs % 88
+		or stream.getNumBytesRemaining() != static_cast<int64>(3 * nProbs)) Fail();
+	for (const auto& probs : { ref(data_->onsetProbs), ref(data_->frameProbs), ref(data_->volumeProbs) })
+	{
+		probs.get().resize(nProbs);
+		if (stream.read(probs.get().data(), static_cast<int>(nProbs)) != static_cast<int>(nProbs)) Fail();
+	}
+	return Decode(DecodeParams());
+}
+
+string PianoToMidi::TranscribeWindowed(const char* mediaFile, const string& path,
+	const string& midiFile, const size_t windowSeconds) const
+{
+	assert(not data_->song and data_->gamma.empty() and "TranscribeWindowed is instead of the whole pipeline");
+	assert(windowSeconds and "Window must not be empty");
+
+	/* Same stages as FFmpegDecode ... WriteMidi, but the only things kept in memory for the whole duration
+	are one float per hop (energy, onset envelope) and three per spectrum frame (for decibel scaling):
+		1. Audio is decoded and resampled frame by frame, and spilled to a temporary file.
+		2. Mel spectrum is calculated in windows of the trimmed audio, overlapping by half of FFT frame,
+			so that every mel frame is made of the same samples as in the whole audio.
+			Constant-Q is streamed through the same decimation chain, CqtStream keeps its own overlap for the lowest filter.
+			Both spectra are spilled, because their decibels and trimmed silence depend on all the frames.
+		3. Harmonic-percussive separation is streamed, HpssStream keeps its own median kernel of frames.
+		4. RNN chunks do not overlap in the whole-audio pipeline either, so they are read one by one,
+			and quantized probabilities are spilled, and then mapped into memory for note extraction. */
+	ostringstream os;
+	const auto hop(static_cast<size_t>(hopLen));
+
+	SpillFile audio(sizeof(float));
+	vector<float> mse; // mean-square energy of hop-length blocks
+	{
+		AudioLoader song(mediaFile);
+		os << "Format:\t\t" << song.GetFormatName() << endl
+			<< "Audio Codec:\t" << song.GetCodecName() << endl
+			<< "Bit_rate:\t\t" << song.GetBitRate() << endl;
+
+		double blockSum(0);
+		size_t blockLen(0);
+		song.DecodeStream(rate, [&audio, &mse, &blockSum, &blockLen, hop](const float* samples, const size_t nSamples)
+		{
+			audio.Append(samples, nSamples);
+			for (size_t i(0); i < nSamples; ++i)
+			{
+				blockSum += static_cast<double>(samples[i]) * samples[i];
+				if (++blockLen < hop) continue;
+				mse.push_back(static_cast<float>(blockSum / hop));
+				blockSum = 0;
+				blockLen = 0;
+			}
+		});
+		if (blockLen) mse.push_back(static_cast<float>(blockSum / blockLen));
+	}
+	if (mse.empty()) throw FFmpegError("Could not decode any audio samples");
+	data_->audioSeconds = static_cast<double>(audio.GetNumRows()) / rate;
+	const auto loud(AudioLoader::LoudRange(mse.data(), mse.size(), audio.GetNumRows(), rate, hopLen));
+	data_->sampleOffset = loud.first;
+	const auto nSamples(loud.second - loud.first);
+	os << "Duration:\t" << audio.GetNumRows() / rate / 60 << " min : " << audio.GetNumRows() / rate % 60 << " sec" << endl
+		<< "Silence trimmed:\t" << data_->sampleOffset / rate << " sec from beginning, " << nSamples / rate << " sec left" << endl;
+	data_->memory.Track(mse.capacity() * sizeof(float));
+	mse.clear();
+	mse.shrink_to_fit();
+	data_->memory.EndStage("Decoding", data_->TrackedBytes());
+
+	const size_t nFft(2'048), margin(nFft / 2); // MelTransform default, half of its frame on each side of a window
+	const auto cqtFMin(27.5f); // ConstantQ default
+	assert(margin % hop == 0 and "Window overlap must be whole hops");
+	CqtStream cqt(rate, 88 * nCqtBins, 12 * nCqtBins, cqtFMin);
+	SpillFile melFile(nMels * sizeof(float)), cqtFile(cqt.GetNumBins() * sizeof(float));
+	SpecPostProc::FrameStats melStats, cqtStats;
+	vector<float> samples, cqtFrames;
+	const auto ReadCqt([&cqt, &cqtFile, &cqtStats, &cqtFrames]()
+	{
+		cqtFrames.resize(cqt.GetNumFrames() * cqt.GetNumBins());
+		const auto nRead(cqt.Read(cqtFrames.data(), cqt.GetNumFrames()));
+		if (nRead == 0) return;
+		cqtFile.Append(cqtFrames.data(), nRead);
+		SpecPostProc::AddStats(&cqtStats, cqtFrames.data(), nRead, cqt.GetNumBins(), true);
+	});
+
+	const auto nMelFrames(nSamples / hop + 1), winFrames(max(windowSeconds * rate / hop, margin / hop + 1));
+	for (size_t first(0), last(0); first < nMelFrames; first = last)
+	{
+		// The rest is merged into the last window, so that it is never shorter than the mirrored padding:
+		last = nMelFrames - first < 3 * winFrames / 2 ? nMelFrames : first + winFrames;
+		const auto begin(first ? first * hop - margin : 0), end(min(nSamples, last * hop + margin));
+		samples.resize(end - begin);
+		audio.Seek(data_->sampleOffset + begin);
+		audio.Read(samples.data(), samples.size());
+
+		// Frames are centered, so the frame i of the window is the frame (begin / hop + i) of the whole audio:
+		const MelTransform mel(samples.data(), samples.size(), rate, nMels, fMin, fMax, htk, true, nFft, hopLen);
+		assert(mel.GetMel()->size() / nMels >= last - begin / hop and "Window is too short for its frames");
+		const auto melFirst(mel.GetMel()->data() + static_cast<ptrdiff_t>((first - begin / hop) * nMels));
+		melFile.Append(melFirst, last - first);
+		SpecPostProc::AddStats(&melStats, melFirst, last - first, nMels, false);
+
+		// Constant-Q gets the same samples without the overlap:
+		const auto cqtBegin(first * hop), cqtEnd(min(nSamples, last * hop));
+		cqt.Push(samples.data() + static_cast<ptrdiff_t>(cqtBegin - begin), cqtEnd - cqtBegin);
+		ReadCqt();
+		data_->memory.Track((samples.capacity() + mel.GetMel()->capacity() + cqtFrames.capacity()
+			+ 3 * (melStats.mse.capacity() + cqtStats.mse.capacity())) * sizeof(float));
+	}
+	cqt.Flush();
+	ReadCqt();
+	samples.clear();
+	samples.shrink_to_fit();
+
+	const auto melScale(SpecPostProc::GetScale(melStats)), cqtScale(SpecPostProc::GetScale(cqtStats, true));
+	melStats = SpecPostProc::FrameStats();
+	cqtStats = SpecPostProc::FrameStats();
+	data_->melOffset = melScale.first;
+	data_->cqtOffset = cqtScale.first;
+	data_->melHop = hopLen;
+	// Both spectra are cut to the same duration, as in GetMidiSeconds:
+	const auto nSpecFrames(min(melScale.last - melScale.first, cqtScale.last - cqtScale.first));
+	os << "MIDI duration:\t" << nSpecFrames * hop / rate / 60 << " min : " << nSpecFrames * hop / rate % 60 << " sec" << endl;
+	data_->memory.EndStage("Mel and constant-Q", data_->TrackedBytes());
+
+	// Same parameters as HarmPerc, onset envelope is centered, and chroma starts from A:
+	HpssStream hpss(cqt.GetNumBins(), 12 * nCqtBins, cqtFMin, 31, 31, 2.f, 1.f, 1.f, 1, 1, false,
+		cqt.GetFftFrameLength() / 2 / hop, AGGREGATE::MEAN, false);
+	SpillFile chromaFile(12 * sizeof(float));
+	vector<float> onsetEnv, chroma;
+	const auto ReadHpss([&hpss, &chromaFile, &onsetEnv, &chroma]()
+	{
+		const auto nReady(hpss.GetNumFrames()), envFirst(onsetEnv.size());
+		if (nReady == 0) return;
+		onsetEnv.resize(envFirst + nReady);
+		chroma.resize(nReady * 12);
+		const auto unusedNumRead(hpss.Read(nullptr, nullptr, onsetEnv.data() + static_cast<ptrdiff_t>(envFirst), chroma.data(), nReady));
+		chromaFile.Append(chroma.data(), nReady);
+	});
+	cqtFrames.resize(1'024 * cqt.GetNumBins());
+	cqtFile.Seek(cqtScale.first);
+	for (size_t done(0); done < nSpecFrames;)
+	{
+		const auto nRead(cqtFile.Read(cqtFrames.data(), min(cqtFrames.size() / cqt.GetNumBins(), nSpecFrames - done)));
+		assert(nRead and "Constant-Q file is shorter than its statistics");
+		for (size_t i(0); i < nRead; ++i)
+		{
+			const auto row(cqtFrames.data() + static_cast<ptrdiff_t>(i * cqt.GetNumBins()));
+			SpecPostProc::Frame2db(row, row, cqt.GetNumBins(), true, cqtScale);
+		}
+		hpss.Push(cqtFrames.data(), nRead);
+		ReadHpss();
+		done += nRead;
+	}
+	hpss.Flush();
+	ReadHpss();
+	cqtFrames.clear();
+	cqtFrames.shrink_to_fit();
+
+	// Same as OnsetPeaksDetect and ChromaSum of onsets only, and tempo is also found from the normalized envelope:
+	vector<float> chrSum(12);
+	const auto minMax(minmax_element(onsetEnv.cbegin(), onsetEnv.cend()));
+	if (not onsetEnv.empty() and *minMax.second > *minMax.first)
+	{
+		const auto minVal(*minMax.first), range(*minMax.second - *minMax.first);
+		for (auto& val : onsetEnv) val = (val - minVal) / range;
+		OnsetPeakPicker picker(rate, hopLen, false, 1);
+		picker.Push(onsetEnv.data(), onsetEnv.size());
+		picker.Flush();
+		for (const auto peak : picker.GetPeaks())
+		{
+			chromaFile.Seek(peak);
+			chromaFile.Read(chroma.data(), 1);
+			transform(chrSum.cbegin(), chrSum.cend(), chroma.cbegin(), chrSum.begin(), plus<float>());
+		}
+	}
+	data_->keySign = HarmonicPercussive::KeySignature(chrSum, false);
+	os << "Key signature:\tmaybe " << data_->keySign << endl;
+	data_->memory.Track((onsetEnv.capacity() + chroma.capacity()) * sizeof(float));
+	data_->memory.EndStage("Harmonic-percussive", data_->TrackedBytes());
+
+	os << data_->Tempo(onsetEnv, rate, hopLen) << endl;
+	onsetEnv.clear();
+	onsetEnv.shrink_to_fit();
+
+	data_->nFrames = static_cast<size_t>(nSeconds) * rate / hop + 1;
+	os << EnsureModels(path);
+	data_->melPadded.resize(data_->nFrames * nMels);
+	for (const auto& probs : { ref(data_->onsetProbs), ref(data_->frameProbs), ref(data_->volumeProbs) })
+		probs.get().resize(data_->nFrames * 88);
+	SpillFile onsetFile(88), frameFile(88), volumeFile(88);
+	melFile.Seek(melScale.first);
+	auto melMin(numeric_limits<float>::max());
+	for (size_t done(0); done < nSpecFrames; done += data_->nFrames)
+	{
+		const auto nRead(melFile.Read(data_->melPadded.data(), min(data_->nFrames, nSpecFrames - done)));
+		for (size_t i(0); i < nRead; ++i)
+		{
+			const auto row(data_->melPadded.data() + static_cast<ptrdiff_t>(i * nMels));
+			SpecPostProc::Frame2db(row, row, nMels, false, melScale);
+			melMin = min(melMin, *min_element(row, row + nMels));
+		}
+		// Only the last chunk is padded, and by then the minimum of the whole spectrum is known:
+		fill(data_->melPadded.begin() + static_cast<ptrdiff_t>(nRead * nMels), data_->melPadded.end(), melMin);
+
+		for (size_t model(0); model < 4; ++model) Predict(model, data_->melPadded.data(), 0);
+		onsetFile.Append(data_->onsetProbs.data(), nRead);
+		frameFile.Append(data_->frameProbs.data(), nRead);
+		volumeFile.Append(data_->volumeProbs.data(), nRead);
+	}
+	data_->memory.Track(data_->TrackedBytes());
+	data_->models.reset(); // shared models stay loaded for the other objects
+	data_->melPadded.clear();
+	data_->melPadded.shrink_to_fit();
+	data_->chunkOnsets.clear();
+	data_->chunkOnsets.shrink_to_fit();
+	data_->chunkOffsets.clear();
+	data_->chunkOffsets.shrink_to_fit();
+	for (const auto& probs : { ref(data_->onsetProbs), ref(data_->frameProbs), ref(data_->volumeProbs) }) probs.get().clear();
+	data_->memory.EndStage("RNN inference", data_->TrackedBytes());
+
+	data_->notes = NoteIntervals::Extract(onsetFile.Map(), frameFile.Map(), volumeFile.Map(), nSpecFrames);
+	data_->nSpilledFrames = nSpecFrames;
+	CalcGamma();
+	os << "Scale:\t\t";
+	for (const auto& n : data_->gamma) os << n << ' ';
+	os << endl << KeySignature();
+	if (data_->notes.size() == 0) throw MidiOutError("There are no notes, nothing to write to MIDI");
+	WriteBytes(File::getCurrentWorkingDirectory().getChildFile(String::fromUTF8(midiFile.c_str())),
+		data_->EncodeMidi(data_->notes, data_->FrameTicks(rate, nSpecFrames)), midiFile);
+	data_->memory.EndStage("Notes", data_->TrackedBytes());
+
+	return move(os.str());
+}
+
+void PianoToMidi::SetMemoryBudget(const size_t budgetBytes) const { data_->memory.SetBudget(budgetBytes); }
+string PianoToMidi::MemoryReport() const { return data_->memory.Report(); }
+
+PianoToMidi::Summary PianoToMidi::GetSummary() const
+{
+	assert(not data_->gamma.empty() and "Notes should be decoded before the summary");
+
+	const auto nProbFrames(data_->frameProbs.empty() ? data_->nSpilledFrames : data_->frameProbs.size() / 88);
+	return { data_->audioSeconds, static_cast<double>(nProbFrames) * data_->melHop / rate, data_->keySign, data_->bpm,
+		data_->tempoMap.empty() ? 0 : data_->tempoMap.size() - 1, data_->notes.size(), data_->memory.GetPeakRss(),
+		data_->memory.GetStageSeconds() };
 }
\ No newline at end of file
@@ -4,15 +4,19 @@
 #include "MelError.h"
 #include "KerasError.h"
 #include "MidiOutError.h"
+#include "NoteIntervals.h"
+#include "ProbabilityMap.h"
 
 // namespace fdeep { class float_vec; }
 
 class PianoToMidi
 {
-	static constexpr int nCqtBins = 3, rate = 16'000, nSeconds = 20;
+	// Hop length is the same as default one of MelTransform and ConstantQ:
+	static constexpr int nCqtBins = 3, rate = 16'000, nSeconds = 20, hopLen = 512;
 	static constexpr float fMin = 30, fMax = 0;
 	static constexpr bool htk = true;
 	static constexpr const char *onsetsModel = "Magenta Onsets.json", *offsetsModel = "Magenta Offsets.json", *framesModel = "Magenta Frames.json", *volumesModel = "Magenta Volumes.json";
+	static constexpr int probsMagic = 0x5032'4D02; // probabilities file signature and format version
 public:
 	static constexpr int nMels = 229;
 
@@ -33,19 +37,65 @@ public:
 	std::string Tempo() const;
 	
 	std::string KerasLoad(const std::string& currExePath) const;
-	WPARAM RnnProbabs() const;
+	size_t RnnProbabs() const; // percent done
 
-	const fdeep::float_vec& GetOnsets() const;
-	const fdeep::float_vec& GetActives() const;
+	const ProbabilityMap& GetOnsets() const;
+	const ProbabilityMap& GetActives() const;
 	const std::array<size_t, 8> & GetMelOctaves() const;
 	const std::array<size_t, 88> & GetMelNoteIndices() const;
 
 	std::string Gamma() const;
 	std::string KeySignature() const;
 
-	void WriteMidi(LPCTSTR fileName, std::string fileA) const;
+	// File names are wide (TCHAR of the Unicode build), so that this header does not need Windows.h:
+	void WriteMidi(const wchar_t* fileName, std::string fileA) const;
+
+	// Onset, frame and volume probabilities are kept after Gamma, so notes can be decoded again without the RNNs,
+	// LoadProbabs is instead of the whole pipeline up to Gamma and KeySignature, and decodes with default settings:
+	void SaveProbabs(const wchar_t* fileName, const std::string& fileA) const;
+	std::string LoadProbabs(const wchar_t* fileName, const std::string& fileA) const;
+	std::string Decode(const DecodeParams& params) const;
+	// Each setting is decoded and written to its own MIDI file (UTF-8 path), all of them in parallel:
+	void DecodeSweep(const std::vector<std::pair<DecodeParams, std::string>>& paramsAndMidiFiles) const;
+
+	// Whole pipeline up to WriteMidi in one call, for recordings too long to be kept in memory:
+	// audio and spectra are spilled to temporary files, and processed in windows of windowSeconds,
+	// constant-Q is streamed through the same decimation chain as CqtTotal, so key and tempo come from the same spectrum.
+	// Memory is not flat, it is O(frames) scalars: mean-square energy of hops, per-frame statistics of both spectra
+	// (FrameStats, for decibels and trimmed silence), and onset envelope, only the spectra are bounded by the window.
+	// Probabilities are not kept after the MIDI file is written, so Decode and SaveProbabs cannot follow it,
+	// both paths are UTF-8:
+	std::string TranscribeWindowed(const char* mediaFile, const std::string& currExePath,
+		const std::string& midiFile, size_t windowSeconds = 120) const;
+
+	// Zero means no limit. Stages that do not fit choose cheaper paths with the same results: mel STFT and onset envelope
+	// are tiled by frames, constant-Q octaves are calculated one after another without copies, and KerasLoad reads
+	// the mel spectrum in place and releases the constant-Q spectrum. The whole-file spectra themselves are not bounded,
+	// so a stage may still be reported over budget by MemoryReport, and TranscribeWindowed is the way for long recordings:
+	void SetMemoryBudget(size_t budgetBytes) const;
+	std::string MemoryReport() const; // tracked buffers, process resident memory and time of every stage
+
+	// The four RNNs are only read, so they can be loaded once, and shared by any number of objects on any threads,
+	// otherwise KerasLoad and TranscribeWindowed load their own ones:
+	struct RnnModels;
+	static std::shared_ptr<const RnnModels> LoadModels(const std::string& currExePath, std::string* log = nullptr);
+	void UseModels(const std::shared_ptr<const RnnModels>& models) const;
+
+	struct Summary
+	{
+		double audioSeconds, midiSeconds; // decoded audio, and without the trimmed silence
+		std::string keySign;
+		float bpm; // zero if audio is too short to estimate it, MIDI is then written at 120 bpm
+		size_t nTempoChanges, nNotes, processPeakRss; // peak resident memory of the whole process so far
+		std::vector<std::pair<std::string, double>> stageSeconds;
+	};
+	Summary GetSummary() const; // after WriteMidi or TranscribeWindowed
 private:
-	std::vector<std::tuple<size_t, size_t, size_t, int>> CalcNoteIntervals() const;
+	std::string EnsureModels(const std::string& path) const; // loads own models, unless shared ones are used
+	// Models in order: onsets, offsets, frames, volumes, the last three probabilities are quantized from pos:
+	void Predict(size_t model, const float* melChunk, size_t pos) const;
+	NoteList CalcNoteIntervals() const;
+	void CalcGamma() const; // seven most frequent notes
 
 	const std::unique_ptr<struct PianoData> data_;
 
@@ -183,7 +183,7 @@ string PianoToMidi_Win::Convert(LPCTSTR mediaFile)
 		bool alreadyAsked(false);
 		for (auto percent(media_->RnnProbabs()); percent < 100u; percent = media_->RnnProbabs())
 		{
-			SendMessage(progBar_, PBM_SETPOS, percent, 0);
+			SendMessage(progBar_, PBM_SETPOS, static_cast<WPARAM>(percent), 0);
 			if (not alreadyAsked and percent >= 1)
 			{
 				alreadyAsked = true;
@@ -406,7 +406,7 @@ void PianoToMidi_Win::OnPaint() const
 
 	const Pen pen(static_cast<ARGB>(Gdiplus::Color::Black), 1);
 	const SolidBrush brush(static_cast<ARGB>(Gdiplus::Color::White));
-	const auto DrawNotes([this, specSize, pixelsPerBin, logScale, &gf, &pen, &brush](const fdeep::float_vec& notes, const bool toFill, const float size)
+	const auto DrawNotes([this, specSize, pixelsPerBin, logScale, &gf, &pen, &brush](const ProbabilityMap& notes, const bool toFill, const float size)
 		{
 			for (size_t i(0); i < min(specSize, notes.size() / 88); ++i) for (size_t j(0); j < 88; ++j)
 			{
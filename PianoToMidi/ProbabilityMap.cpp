@@ -0,0 +1,15 @@
+#include "stdafx.h"
+#include "ProbabilityMap.h"
+
+using namespace std;
+
+uint8_t ProbabilityMap::Quantize(const float prob)
+{
+	return static_cast<uint8_t>(lround(min(max(prob, 0.f), 1.f) * levels));
+}
+
+void ProbabilityMap::Assign(const size_t pos, const float* probs, const size_t n)
+{
+	assert(pos + n <= quants_.size() and "Probabilities do not fit into the map");
+	transform(probs, probs + static_cast<ptrdiff_t>(n), quants_.begin() + static_cast<ptrdiff_t>(pos), Quantize);
+}
\ No newline at end of file
@@ -0,0 +1,26 @@
+#pragma once
+
+// Probabilities (0...1) of frames x 88 pitches, quantized to one byte each, so four times less memory than floats:
+class ProbabilityMap
+{
+public:
+	static constexpr float levels = 255;
+
+	// n probabilities are quantized and stored from position pos:
+	void Assign(size_t pos, const float* probs, size_t n);
+	static uint8_t Quantize(float prob);
+
+#pragma warning(push)
+#pragma warning(disable:4514) // Unreferenced inline function has been removed
+	void resize(size_t n) { quants_.resize(n); }
+	void clear() { quants_.clear(); quants_.shrink_to_fit(); }
+	size_t size() const { return quants_.size(); }
+	bool empty() const { return quants_.empty(); }
+
+	const uint8_t* data() const { return quants_.data(); }
+	uint8_t* data() { return quants_.data(); }
+	float at(size_t i) const { return quants_.at(i) / levels; }
+#pragma warning(pop)
+private:
+	std::vector<uint8_t> quants_;
+};
\ No newline at end of file
@@ -19,40 +19,52 @@ ShortTimeFourier::ShortTimeFourier(const size_t frameLen,
 
 ShortTimeFourier::~ShortTimeFourier() {}
 
-void ShortTimeFourier::RealForward(const float* rawAudio, const size_t nSamples, int hopLen)
+void ShortTimeFourier::RealForward(const float* rawAudio, const size_t nSamples, int hopLen,
+	const size_t firstFrame, const size_t nFrames)
 {
-#ifdef _DEBUG
-	using boost::alignment::is_aligned;
-#endif
 	if (hopLen == 0) hopLen = static_cast<int>(frameLen_) / 4;
 	assert(hopLen && "Hop length must be non-zero");
 
-	// Pad (frame length / 2) both sides, so that frames are centered:
-	AlignedVector<float> paddedBuff(nSamples + frameLen_);
-	CHECK_IPP_RESULT(PadFunc_(rawAudio, nSamples, paddedBuff.data(), frameLen_));
-	assert(paddedBuff.size() >= frameLen_ &&
-		"PadCentered function must return at least frame length number of samples");
-	assert(is_aligned(paddedBuff.data(), 64) and "Padded audio buffer is not aligned");
+	// Frames are centered (padded by frame length / 2 both sides), frame t covers padded samples [t * hop, t * hop + frame length),
+	// and the end may get truncated. Only the frames overlapping padding are read from the padded copy of signal ends,
+	// or of the whole signal if it is that short, the rest of frames are read from the signal in place:
+	const auto nTotal(nSamples / static_cast<size_t>(hopLen) + 1);
+	assert(firstFrame < nTotal and "First frame is beyond the end of signal");
+	nFrames_ = nFrames ? min(nFrames, nTotal - firstFrame) : nTotal - firstFrame;
+	const auto isShort(nSamples <= 2 * frameLen_);
+	AlignedVector<float> ends((isShort ? nSamples : 2 * frameLen_) + frameLen_);
+	if (isShort) CHECK_IPP_RESULT(PadFunc_(rawAudio, nSamples, ends.data(), frameLen_));
+	else
+	{
+		// Both ends are enough for any padding mode, including wrapping:
+		AlignedVector<float> edges(rawAudio, rawAudio + static_cast<ptrdiff_t>(frameLen_));
+		edges.insert(edges.cend(), rawAudio + static_cast<ptrdiff_t>(nSamples - frameLen_),
+			rawAudio + static_cast<ptrdiff_t>(nSamples));
+		CHECK_IPP_RESULT(PadFunc_(edges.data(), edges.size(), ends.data(), frameLen_));
+	}
 
-	// Vertical stride = 1 sample, horizontal stride = hop length, the end may get truncated:
-	nFrames_ = (paddedBuff.size() - frameLen_) / hopLen + 1;
 	stft_.resize(nFrames_ * nFreqs_); // FFT will write here half + 1 complex numbers
-	// now it is columns, but will be rows after transpose
-	for (ptrdiff_t i(0); i < static_cast<ptrdiff_t>(nFrames_); ++i)
+	// Frame-major: every row is one frame, so there is no need to transpose afterwards
+	for (size_t i(0); i < nFrames_; ++i)
 	{
-		// Temporarily window the time series into buffer with different type (complex instead of float)
-		// FFT will overwrite result on top:
-		CopyMemory(stft_.data() + i * nFreqs_, paddedBuff.data() + i * hopLen,
-			// The last two floats (one complex) is currently empty:
-			frameLen_ * sizeof paddedBuff.front());
-
-		WinFunc_->multiplyWithWindowingTable(reinterpret_cast<float*>(
-			stft_.data() + i * nFreqs_), frameLen_);
-		// Conjugate to match phase from DPWE code:
-		fft_->performRealOnlyForwardTransform(reinterpret_cast<float*>(
-			stft_.data() + i * nFreqs_), true);
+		const auto start((firstFrame + i) * static_cast<size_t>(hopLen));
+		const auto dest(stft_.data() + static_cast<ptrdiff_t>(i * nFreqs_));
+		if (isShort or start < frameLen_ / 2) FrameForward(ends.data() + static_cast<ptrdiff_t>(start), dest);
+		else if (start + frameLen_ > frameLen_ / 2 + nSamples) FrameForward(ends.data()
+			+ static_cast<ptrdiff_t>(start + 2 * frameLen_ - nSamples), dest);
+		else FrameForward(rawAudio + static_cast<ptrdiff_t>(start - frameLen_ / 2), dest);
 	}
+}
+
+void ShortTimeFourier::FrameForward(const float* frame, complex<float>* dest) const
+{
+	// Temporarily window the time series into buffer with different type (complex instead of float)
+	// FFT will overwrite result on top:
+	CopyMemory(dest, frame,
+		// The last two floats (one complex) is currently empty:
+		frameLen_ * sizeof *frame);
 
-	MKL_Cimatcopy('R', 'T', nFrames_, nFreqs_, { 1, 0 },
-		reinterpret_cast<MKL_Complex8*>(stft_.data()), nFreqs_, nFrames_);
+	WinFunc_->multiplyWithWindowingTable(reinterpret_cast<float*>(dest), frameLen_);
+	// Conjugate to match phase from DPWE code:
+	fft_->performRealOnlyForwardTransform(reinterpret_cast<float*>(dest), true);
 }
\ No newline at end of file
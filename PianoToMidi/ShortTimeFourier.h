@@ -7,11 +7,16 @@ public:
 		WIN_FUNC window = WIN_FUNC::HANN, PAD_MODE pad = PAD_MODE::MIRROR);
 	~ShortTimeFourier();
 
-	void RealForward(const float* rawAudio, size_t nSamples, int hopLen = 0);
+	// Frames [firstFrame, firstFrame + nFrames) of the centered STFT, zero frames means up to the end of signal:
+	void RealForward(const float* rawAudio, size_t nSamples, int hopLen = 0, size_t firstFrame = 0, size_t nFrames = 0);
+	// One frame (frame length samples) --> frame length / 2 + 1 complex numbers:
+	void FrameForward(const float* frame, std::complex<float>* dest) const;
 #pragma warning(push)
 #pragma warning(disable:4514) // Unreferenced inline function has been removed
+	// Frame-major: nFrames rows of (frameLen / 2 + 1) complex numbers
 	const AlignedVector<std::complex<float>>& GetSTFT() const { return stft_; }
 	size_t GetNumFrames() const { return nFrames_; }
+	size_t GetNumFreqs() const { return nFreqs_; }
 #pragma warning(pop)
 private:
 	const size_t frameLen_;
@@ -0,0 +1,93 @@
+#include "stdafx.h"
+#include "SlidingMedian.h"
+
+using namespace std;
+
+size_t SlidingMedian::Mirror(ptrdiff_t index, const size_t size)
+{
+	assert(size > 0 and "Nothing to mirror");
+	const auto last(static_cast<ptrdiff_t>(size) - 1);
+	if (last == 0) return 0;
+	// Reflect about the first and last elements, repeatedly if kernel is longer than the array:
+	while (index < 0 or index > last) index = index < 0 ? -index : 2 * last - index;
+	return static_cast<size_t>(index);
+}
+
+void SlidingMedian::Replace(float* window, const size_t kernel, const float oldValue, const float newValue)
+{
+	// Window is kept sorted, so the old value is found by binary search,
+	// and only the elements between the old and the new positions get shifted:
+	const auto pos(lower_bound(window, window + kernel, oldValue));
+	assert(pos != window + kernel and *pos == oldValue and "Old value is not in the sliding window");
+	if (newValue > oldValue)
+	{
+		const auto next(lower_bound(pos + 1, window + kernel, newValue));
+		const auto unusedIter(move(pos + 1, next, pos));
+		*(next - 1) = newValue;
+	}
+	else
+	{
+		const auto next(upper_bound(window, pos, newValue));
+		const auto unusedIter(move_backward(next, pos, pos + 1));
+		*next = newValue;
+	}
+}
+
+void SlidingMedian::AlongTime(const float* src, const size_t nRows, const size_t nCols,
+	const int kernel, float* dest, const size_t colFirst, size_t colLast)
+{
+	assert(kernel > 0 and "Median filter kernel size must be positive");
+	colLast = min(colLast, nCols);
+	assert(colFirst < colLast and "Empty range of columns");
+	const auto k(static_cast<size_t>(kernel)), half(k / 2), nTile(colLast - colFirst);
+
+	// All bins move one frame forward together, so that both input and output are read and written row by row:
+	vector<float> windows(nTile * k);
+	for (size_t j(0); j < nTile; ++j)
+	{
+		const auto window(windows.data() + static_cast<ptrdiff_t>(j * k));
+		for (size_t i(0); i < k; ++i) window[i] = src[Mirror(static_cast<ptrdiff_t>(i)
+			- static_cast<ptrdiff_t>(half), nRows) * nCols + colFirst + j];
+		sort(window, window + static_cast<ptrdiff_t>(k));
+	}
+
+	for (size_t t(0); t < nRows; ++t)
+	{
+		if (t)
+		{
+			const auto rowOld(src + static_cast<ptrdiff_t>(Mirror(static_cast<ptrdiff_t>(t - 1)
+				- static_cast<ptrdiff_t>(half), nRows) * nCols + colFirst)),
+				rowNew(src + static_cast<ptrdiff_t>(Mirror(static_cast<ptrdiff_t>(t - 1 + k)
+					- static_cast<ptrdiff_t>(half), nRows) * nCols + colFirst));
+			for (size_t j(0); j < nTile; ++j)
+				Replace(windows.data() + static_cast<ptrdiff_t>(j * k), k, rowOld[j], rowNew[j]);
+		}
+		for (size_t j(0); j < nTile; ++j) dest[t * nCols + colFirst + j] = windows.at(j * k + half);
+	}
+}
+
+void SlidingMedian::AlongBins(const float* src, const size_t nRows, const size_t nCols,
+	const int kernel, float* dest, const size_t rowFirst, size_t rowLast)
+{
+	assert(kernel > 0 and "Median filter kernel size must be positive");
+	rowLast = min(rowLast, nRows);
+	assert(rowFirst < rowLast and "Empty range of rows");
+	const auto k(static_cast<size_t>(kernel)), half(k / 2);
+
+	vector<float> window(k);
+	for (size_t t(rowFirst); t < rowLast; ++t)
+	{
+		const auto row(src + static_cast<ptrdiff_t>(t * nCols));
+		for (size_t i(0); i < k; ++i) window.at(i) = row[Mirror(static_cast<ptrdiff_t>(i)
+			- static_cast<ptrdiff_t>(half), nCols)];
+		sort(window.begin(), window.end());
+
+		for (size_t j(0); j < nCols; ++j)
+		{
+			if (j) Replace(window.data(), k, row[Mirror(static_cast<ptrdiff_t>(j - 1)
+				- static_cast<ptrdiff_t>(half), nCols)], row[Mirror(static_cast<ptrdiff_t>(j - 1 + k)
+					- static_cast<ptrdiff_t>(half), nCols)]);
+			dest[t * nCols + j] = window.at(half);
+		}
+	}
+}
\ No newline at end of file
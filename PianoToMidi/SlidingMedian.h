@@ -0,0 +1,18 @@
+#pragma once
+
+class SlidingMedian abstract
+{
+public:
+	// Median filters of frame-major spectrum (nRows frames x nCols bins), in float32 without any padded copies,
+	// borders are mirrored without repeating the edge, same as ippBorderMirror:
+	// Only columns (or rows) from the given range are written, so that the range can be a tile of separate thread,
+	// neighbouring columns (or rows) are read directly from the whole source, no halo copies needed:
+	static void AlongTime(const float* src, size_t nRows, size_t nCols, int kernel, float* dest,
+		size_t colFirst = 0, size_t colLast = std::numeric_limits<size_t>::max());
+	static void AlongBins(const float* src, size_t nRows, size_t nCols, int kernel, float* dest,
+		size_t rowFirst = 0, size_t rowLast = std::numeric_limits<size_t>::max());
+	// Index into array of the given size after reflection about its ends:
+	static size_t Mirror(ptrdiff_t index, size_t size);
+private:
+	static void Replace(float* window, size_t kernel, float oldValue, float newValue);
+};
\ No newline at end of file
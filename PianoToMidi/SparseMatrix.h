@@ -1,28 +0,0 @@
-#pragma once
-
-class SparseMatrix
-{
-public:
-	explicit SparseMatrix(MKL_Complex8* dense, int nRows, int nCols, size_t nNonZeros);
-#pragma warning(suppress:4514) // Unreferenced inline function has been removed
-	~SparseMatrix() { Destroy(); }
-
-	void Scale(Ipp32f scale);
-	void RowMajorMultiply(const MKL_Complex8* source, MKL_Complex8* dest, int nDestColumns) const;
-private:
-	void Create();
-	void Destroy();
-
-	const int nCols_;
-#ifdef _WIN64
-	const byte pad_[4]{ 0 };
-#elif not defined _WIN32
-#	error It should be either 32- or 64-bit Windows
-#endif
-	AlignedVector<MKL_Complex8> Aval_;
-	AlignedVector<int> Acol_, Arow_;
-
-	sparse_matrix_t csr_;
-
-	const SparseMatrix& operator=(const SparseMatrix&) = delete;
-};
\ No newline at end of file
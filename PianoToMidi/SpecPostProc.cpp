@@ -5,28 +5,6 @@
 
 using namespace std;
 
-void SpecPostProc::Amplitude2power(AlignedVector<float>* spectr)
-{
-	CHECK_IPP_RESULT(ippsSqr_32f_I(spectr->data(), static_cast<int>(spectr->size())));
-}
-
-void SpecPostProc::TrimSilence(AlignedVector<float>* spectr, const size_t nBins, const float aMin, const float topDb)
-{
-	AlignedVector<Ipp32f> mse(spectr->size() / nBins); // Mean-square energy:
-	for (size_t i(0); i < mse.size(); ++i) CHECK_IPP_RESULT(ippsMean_32f(spectr->data() + static_cast<ptrdiff_t>(i * nBins), static_cast<int>(nBins), &mse.at(i), ippAlgHintFast));
-
-	Ipp32f mseMax;
-	CHECK_IPP_RESULT(ippsMax_32f(mse.data(), static_cast<int>(mse.size()), &mseMax));
-	Power2db(&mse, mseMax, aMin, 0);
-
-	const auto iterStart(find_if(mse.cbegin(), mse.cend(), [topDb](Ipp32f mse_i) { return mse_i > -topDb; }));
-	const auto iterEnd(find_if(mse.crbegin(), mse.crend(), [topDb](Ipp32f mse_i) { return mse_i > -topDb; }));
-
-	const auto unusedIter(spectr->erase(spectr->cbegin(), spectr->cbegin() + (iterStart - mse.cbegin()) * static_cast<ptrdiff_t>(nBins)));
-	spectr->resize(spectr->size() - (iterEnd - mse.crbegin()) * static_cast<ptrdiff_t>(nBins));
-	assert(spectr->size() % nBins == 0 and "Spectrum is not rectangular after silence trimming");
-}
-
 void SpecPostProc::Power2db(AlignedVector<float>* spectr, const float ref, const float aMin, const float topDb)
 {
 	assert(*min_element(spectr->data(), spectr->data() + static_cast<ptrdiff_t>(spectr->size())) >= 0 and
@@ -48,4 +26,86 @@ void SpecPostProc::Power2db(AlignedVector<float>* spectr, const float ref, const
 		CHECK_IPP_RESULT(ippsMax_32f(spectr->data(), static_cast<int>(spectr->size()), &maxDb));
 		CHECK_IPP_RESULT(ippsThreshold_LT_32f_I(spectr->data(), static_cast<int>(spectr->size()), maxDb - topDb));
 	}
+}
+
+size_t SpecPostProc::Spectrum2db(AlignedVector<float>* spectr, const size_t nBins, const bool isAmplitude,
+	const bool isRefMin, const float ref, const float aMin, const float trimDb, const float topDb)
+{
+	assert(spectr->size() % nBins == 0 and "Spectrum is not rectangular");
+	const auto nFrames(spectr->size() / nBins);
+	if (nFrames == 0) return 0;
+
+	/* Equivalent to squaring, trimming silence by mean-square energy of frames, and Power2db,
+	but there is just one read pass collecting energy, minimum and maximum power of each frame,
+	and one write pass converting each frame to dB, while it is still in cache,
+	and moving it to its final place instead of erasing the trimmed frames */
+
+	FrameStats stats;
+	AddStats(&stats, spectr->data(), nFrames, nBins, isAmplitude);
+	const auto scale(GetScale(stats, isRefMin, ref, aMin, trimDb, topDb));
+
+	for (size_t i(scale.first); i < scale.last; ++i) Frame2db(spectr->data() + static_cast<ptrdiff_t>(i * nBins),
+		spectr->data() + static_cast<ptrdiff_t>((i - scale.first) * nBins), nBins, isAmplitude, scale, aMin);
+	spectr->resize((scale.last - scale.first) * nBins);
+
+	return scale.first;
+}
+
+void SpecPostProc::AddStats(FrameStats* stats, const float* frames, const size_t nFrames, const size_t nBins, const bool isAmplitude)
+{
+	const auto first(stats->mse.size());
+	stats->mse.resize(first + nFrames);
+	stats->minPow.resize(first + nFrames);
+	stats->maxPow.resize(first + nFrames);
+	for (auto i(first); i < stats->mse.size(); ++i)
+	{
+		const auto row(frames + static_cast<ptrdiff_t>((i - first) * nBins));
+		CHECK_IPP_RESULT(ippsMinMax_32f(row, static_cast<int>(nBins), &stats->minPow.at(i), &stats->maxPow.at(i)));
+		assert(stats->minPow.at(i) >= 0 and "Spectrum values must be non-negative");
+		if (isAmplitude)
+		{
+			CHECK_IPP_RESULT(ippsDotProd_32f(row, row, static_cast<int>(nBins), &stats->mse.at(i)));
+			stats->mse.at(i) /= nBins;
+			stats->minPow.at(i) *= stats->minPow.at(i);
+			stats->maxPow.at(i) *= stats->maxPow.at(i);
+		}
+		else CHECK_IPP_RESULT(ippsMean_32f(row, static_cast<int>(nBins), &stats->mse.at(i), ippAlgHintFast));
+	}
+}
+
+SpecPostProc::DbScale SpecPostProc::GetScale(const FrameStats& stats, const bool isRefMin,
+	const float ref, const float aMin, const float trimDb, const float topDb)
+{
+	assert(ref >= 0 and aMin > 0 and "Reference and minimum powers must be strictly positive");
+	assert(topDb >= 0 and "top_db must be non-negative");
+	assert(not stats.mse.empty() and "No frame statistics collected");
+
+	// Frame is not silent, if its energy is above trimDb below the loudest frame:
+	const auto& mse(stats.mse);
+	const auto mseThresh(max(aMin, *max_element(mse.cbegin(), mse.cend())) * pow(10.f, -trimDb / 10));
+	const auto IsLoud([aMin, mseThresh](const float mse_i) { return max(aMin, mse_i) > mseThresh; });
+	const auto first(static_cast<size_t>(find_if(mse.cbegin(), mse.cend(), IsLoud) - mse.cbegin())),
+		last(mse.size() - static_cast<size_t>(find_if(mse.crbegin(), mse.crend(), IsLoud) - mse.crbegin()));
+	assert(first < last and "The loudest frame must not be trimmed");
+
+	// S_db = 10 * log10(S / ref) ~= 10 * log10(S) - 10 * log10(ref)
+	const auto refDb(10 * log10(max(aMin, isRefMin ? *min_element(stats.minPow.cbegin()
+		+ static_cast<ptrdiff_t>(first), stats.minPow.cbegin() + static_cast<ptrdiff_t>(last)) : ref)));
+	// Threshold the output at topDb below the peak:
+	const auto floorDb(topDb ? 10 * log10(max(aMin, *max_element(stats.maxPow.cbegin() + static_cast<ptrdiff_t>(first),
+		stats.maxPow.cbegin() + static_cast<ptrdiff_t>(last)))) - refDb - topDb : numeric_limits<float>::lowest());
+	return DbScale{ first, last, refDb, floorDb };
+}
+
+void SpecPostProc::Frame2db(const float* src, float* dest, const size_t nBins, const bool isAmplitude,
+	const DbScale& scale, const float aMin)
+{
+	if (dest != src) CHECK_IPP_RESULT(ippsCopy_32f(src, dest, static_cast<int>(nBins)));
+
+	if (isAmplitude) CHECK_IPP_RESULT(ippsSqr_32f_I(dest, static_cast<int>(nBins)));
+	CHECK_IPP_RESULT(ippsThreshold_LT_32f_I(dest, static_cast<int>(nBins), aMin));
+	CHECK_IPP_RESULT(ippsLog10_32f_A11(dest, dest, static_cast<Ipp32s>(nBins)));
+	CHECK_IPP_RESULT(ippsMulC_32f_I(10, dest, static_cast<int>(nBins)));
+	CHECK_IPP_RESULT(ippsSubC_32f_I(scale.refDb, dest, static_cast<int>(nBins)));
+	CHECK_IPP_RESULT(ippsThreshold_LT_32f_I(dest, static_cast<int>(nBins), scale.floorDb));
 }
\ No newline at end of file
@@ -3,7 +3,22 @@
 class SpecPostProc abstract
 {
 public:
-	static void Amplitude2power(AlignedVector<float>* spectr);
-	static void TrimSilence(AlignedVector<float>* spectr, size_t nBins, float aMin = 1e-10f, float topDb = 60.f);
 	static void Power2db(AlignedVector<float>* spectr, float ref = 1.f, float aMin = 1e-10f, float topDb = 80.f);
+
+	// Frame-major spectrum (amplitude or power) --> squared if amplitude, silent frames at both ends trimmed,
+	// converted to dB relative to either 'ref' or minimum power, and thresholded at 'topDb' below the peak.
+	// Returns the number of frames trimmed from the beginning:
+	static size_t Spectrum2db(AlignedVector<float>* spectr, size_t nBins, bool isAmplitude, bool isRefMin = false,
+		float ref = 1.f, float aMin = 1e-10f, float trimDb = 60.f, float topDb = 80.f);
+
+	// The same in parts, for spectra spilled to disk frame by frame:
+	// statistics of every frame are collected as frames come, then the trimmed range and decibel shift are found,
+	// and frames are converted one by one (in place, if src == dest):
+	struct FrameStats { std::vector<float> mse, minPow, maxPow; };
+	struct DbScale { size_t first, last; float refDb, floorDb; }; // trimmed frames [first, last)
+	static void AddStats(FrameStats* stats, const float* frames, size_t nFrames, size_t nBins, bool isAmplitude);
+	static DbScale GetScale(const FrameStats& stats, bool isRefMin = false,
+		float ref = 1.f, float aMin = 1e-10f, float trimDb = 60.f, float topDb = 80.f);
+	static void Frame2db(const float* src, float* dest, size_t nBins, bool isAmplitude,
+		const DbScale& scale, float aMin = 1e-10f);
 };
\ No newline at end of file
@@ -0,0 +1,4 @@
+#pragma once
+#include "MyError.h"
+
+BORIS_ERROR(Spill)
\ No newline at end of file
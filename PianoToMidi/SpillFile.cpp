@@ -0,0 +1,85 @@
+#include "stdafx.h"
+#include "SpillFile.h"
+#include "SpillError.h"
+
+using namespace std;
+using namespace juce;
+
+struct SpillData
+{
+	size_t rowBytes = 0, nRows = 0, position = 0;
+	TemporaryFile file = TemporaryFile(".spill");
+
+	unique_ptr<FileOutputStream> output;
+	unique_ptr<FileInputStream> input;
+	unique_ptr<MemoryMappedFile> map; // destroyed before the file is deleted
+};
+
+SpillFile::SpillFile(const size_t rowBytes) : data_(make_unique<SpillData>())
+{
+	assert(rowBytes and "Rows must not be empty");
+	data_->rowBytes = rowBytes;
+	data_->output = make_unique<FileOutputStream>(data_->file.getFile());
+	if (data_->output->failedToOpen()) throw SpillError(("Could not create temporary file: "
+		+ data_->file.getFile().getFullPathName().toStdString()).c_str());
+}
+SpillFile::~SpillFile() {} // C4710 Function not inlined
+
+size_t SpillFile::GetNumRows() const { return data_->nRows; }
+
+void SpillFile::Append(const void* rows, const size_t nRows)
+{
+	assert(data_->output and "Rows are appended after the file has been read");
+	if (not data_->output->write(rows, nRows * data_->rowBytes))
+		throw SpillError("Could not write to temporary file, is the disk full?");
+	data_->nRows += nRows;
+}
+
+void SpillFile::EndAppend()
+{
+	if (not data_->output) return;
+	data_->output->flush();
+	if (data_->output->getStatus().failed()) throw SpillError("Could not write to temporary file, is the disk full?");
+	data_->output.reset();
+}
+
+void SpillFile::Seek(const size_t row)
+{
+	assert(row <= data_->nRows and "Seeking beyond the end of temporary file");
+	EndAppend();
+	data_->position = row;
+	if (data_->input and not data_->input->setPosition(static_cast<int64>(row * data_->rowBytes)))
+		throw SpillError("Could not seek in temporary file");
+}
+
+size_t SpillFile::Read(void* dest, const size_t nRows)
+{
+	EndAppend();
+	if (not data_->input)
+	{
+		data_->input = make_unique<FileInputStream>(data_->file.getFile());
+		if (data_->input->failedToOpen()) throw SpillError("Could not open temporary file");
+		Seek(data_->position);
+	}
+
+	const auto nRead(min(nRows, data_->nRows - data_->position));
+	assert(nRead * data_->rowBytes <= static_cast<size_t>(numeric_limits<int>::max()) and "Too many rows to read at once");
+	if (data_->input->read(dest, static_cast<int>(nRead * data_->rowBytes)) != static_cast<int>(nRead * data_->rowBytes))
+		throw SpillError("Could not read from temporary file");
+	data_->position += nRead;
+	return nRead;
+}
+
+const uint8_t* SpillFile::Map()
+{
+	EndAppend();
+	if (not data_->map)
+	{
+		// Mapped pages are backed by the file, so the OS can drop them instead of swapping:
+		data_->map = make_unique<MemoryMappedFile>(data_->file.getFile(), MemoryMappedFile::readOnly);
+		if (data_->nRows and (not data_->map->getData()
+			or data_->map->getSize() != data_->nRows * data_->rowBytes))
+			throw SpillError("Could not map temporary file into memory");
+	}
+	return static_cast<const uint8_t*>(data_->map->getData());
+}
\ No newline at end of file
@@ -0,0 +1,26 @@
+#pragma once
+
+// Rows of the same size are appended to a temporary file, and then either read back, or mapped into memory,
+// so that intermediate results of long recordings take disk space instead of RAM.
+// The file is deleted together with the object:
+class SpillFile
+{
+public:
+	explicit SpillFile(size_t rowBytes);
+	~SpillFile();
+
+	void Append(const void* rows, size_t nRows);
+	// Appending is over after the first Seek, Read or Map:
+	void Seek(size_t row);
+	size_t Read(void* dest, size_t nRows); // returns number of rows actually read
+	const uint8_t* Map(); // all the rows, valid while the object lives
+
+	size_t GetNumRows() const;
+private:
+	void EndAppend();
+
+	const std::unique_ptr<struct SpillData> data_;
+
+	SpillFile(const SpillFile&) = delete;
+	const SpillFile& operator=(const SpillFile&) = delete;
+};
\ No newline at end of file
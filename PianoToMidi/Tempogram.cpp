@@ -1,49 +1,30 @@
 ﻿#include "stdafx.h"
 
+#include "AlignedVector.h"
 #include "EnumFuncs.h"
 #include "Tempogram.h"
 
-#include "AlignedVector.h"
-#include "HarmonicPercussive.h"
+#include "ParallelFor.h"
 #include "IntelCheckStatus.h"
 
 using namespace std;
 
-void AutoCorrelate(vector<float>* srcDst)
+void AutoCorrelate(float* frame, const int nDft, const IppsDFTSpec_R_32f* spec, Ipp8u* workBuf)
 {
-	// Bounded (truncated) auto-correlation y*y along the second axis
-
-	const auto sigSize(srcDst->size());
-	// Pad out the signal with zeros to support full-length auto-correlation:
-	srcDst->resize(srcDst->size() * 2 + 1, 0);
-
-	int specSize, initSize, workSize;
-	CHECK_IPP_RESULT(ippsDFTGetSize_R_32f(static_cast<int>(srcDst->size()),
-		IPP_FFT_DIV_INV_BY_N, ippAlgHintFast, &specSize, &initSize, &workSize));
-	const unique_ptr<BYTE[]> spec(new BYTE[static_cast<size_t>(specSize)]);
-	vector<Ipp8u> initBuf(static_cast<size_t>(initSize)), workBuf(static_cast<size_t>(workSize));
-
-	CHECK_IPP_RESULT(ippsDFTInit_R_32f(static_cast<int>(srcDst->size()),
-		IPP_FFT_DIV_INV_BY_N, ippAlgHintFast,
-		reinterpret_cast<IppsDFTSpec_R_32f*>(spec.get()), initBuf.data()));
-
-	srcDst->emplace_back(0.f); // because we have odd length
-	CHECK_IPP_RESULT(ippsDFTFwd_RToCCS_32f(srcDst->data(), srcDst->data(),
-		reinterpret_cast<IppsDFTSpec_R_32f*>(spec.get()), workBuf.data())); // Power spectrum
-
-	for (size_t i(0); i < srcDst->size() - 1; i += 2)
+	// Bounded (truncated) auto-correlation y*y along the second axis,
+	// frame is zero-padded to nDft + 1 (odd DFT length, plus one for CCS format)
+	// to support full-length auto-correlation:
+	CHECK_IPP_RESULT(ippsDFTFwd_RToCCS_32f(frame, frame, spec, workBuf)); // Power spectrum
+	for (int i(0); i < nDft; i += 2)
 	{
-		srcDst->at(i) = srcDst->at(i) * srcDst->at(i) + srcDst->at(i + 1) * srcDst->at(i + 1);
-		srcDst->at(i + 1) = 0;
+		frame[i] = frame[i] * frame[i] + frame[i + 1] * frame[i + 1];
+		frame[i + 1] = 0;
 	}
-
-	CHECK_IPP_RESULT(ippsDFTInv_CCSToR_32f(srcDst->data(), srcDst->data(),
-		reinterpret_cast<IppsDFTSpec_R_32f*>(spec.get()), workBuf.data())); // Convert back to time domain
-	srcDst->resize(sigSize);
+	CHECK_IPP_RESULT(ippsDFTInv_CCSToR_32f(frame, frame, spec, workBuf)); // Convert back to time domain
 }
 
-void Tempogram::Calculate(const vector<float>& oEnv, const int winLen, const bool toCenter,
-	const WIN_FUNC window, const NORM_TYPE norm)
+void Tempogram::Calculate(const vector<float>& oEnv, const int winLen, const int hop, const bool toCenter,
+	const WIN_FUNC window, const NORM_TYPE norm, const AGGREGATE aggr)
 {
 	/* Local (localized) autocorrelation of the onset strength envelope
 		Grosche, Peter, Meinard Müller, and Frank Kurth.
@@ -56,6 +37,7 @@ void Tempogram::Calculate(const vector<float>& oEnv, const int winLen, const boo
 	// The default length of the onset autocorrelation window
 	// (384 in frames / onset measurements) corresponds to 384 * hop_length / sr ~= 8.9 seconds
 	assert(winLen > 0 and "Window length must be positive and non-zero");
+	assert(hop > 0 and "Tempogram hop must be positive and non-zero");
 
 	vector<float> paddedEnvelope;
 	vector<float>::iterator unusedIter;
@@ -71,58 +53,123 @@ void Tempogram::Calculate(const vector<float>& oEnv, const int winLen, const boo
 	}
 	else paddedEnvelope = oEnv; // windows are left-aligned
 
-	if (paddedEnvelope.size() < static_cast<size_t>(winLen))
-	{
-		autoCorr2D_.clear();
-		return;
-	}
+	autoCorr_.clear();
+	tempos_.clear();
+	if (paddedEnvelope.size() < static_cast<size_t>(winLen)) return;
 
 	// If accidentally get additional frames, truncate to the length of the original signal:
-	autoCorr2D_.assign(min(oEnv.size(), paddedEnvelope.size() - winLen),
-		vector<float>(static_cast<size_t>(winLen)));
+	const auto win(static_cast<size_t>(winLen)), step(static_cast<size_t>(hop)),
+		nFrames((min(oEnv.size(), paddedEnvelope.size() - win) + step - 1) / step);
+	if (nFrames == 0) return;
+	if (aggr == AGGREGATE::MEDIAN) autoCorr_.resize(nFrames * win);
 
-	auto WinFunc(GetWindowFunc(window, static_cast<size_t>(winLen)));
-	auto NormFunc(GetNormFuncReal(norm));
-	// Carve onset envelope into frames:
-	for (size_t i(0); i < autoCorr2D_.size(); ++i) // hop length = 1
+	// One DFT plan and one window table for all the frames, and every thread has its own work buffer:
+	const auto nDft(2 * winLen + 1);
+	int specSize, initSize, workSize;
+	CHECK_IPP_RESULT(ippsDFTGetSize_R_32f(nDft, IPP_FFT_DIV_INV_BY_N, ippAlgHintFast,
+		&specSize, &initSize, &workSize));
+	const unique_ptr<BYTE[]> specBuf(new BYTE[static_cast<size_t>(specSize)]);
+	const auto spec(reinterpret_cast<IppsDFTSpec_R_32f*>(specBuf.get()));
+	vector<Ipp8u> initBuf(static_cast<size_t>(initSize));
+	CHECK_IPP_RESULT(ippsDFTInit_R_32f(nDft, IPP_FFT_DIV_INV_BY_N, ippAlgHintFast, spec, initBuf.data()));
+
+	vector<float> winTable(win, 1);
+	GetWindowFunc(window, win)->multiplyWithWindowingTable(winTable.data(), winTable.size());
+	const auto NormFunc(GetNormFuncReal(norm));
+
+	/* Rectangular window does not change from frame to frame, so instead of the DFT,
+	r[t + 1, k] = r[t, k] - x[t] * x[t + k] + x[t + W - k] * x[t + W],
+	in double precision, and every tile starts from the direct sum, so rounding does not accumulate */
+	const auto isSliding(window == WIN_FUNC::RECT and step < static_cast<size_t>(log2(nDft)));
+
+	const auto nTiles(static_cast<size_t>(max(1u, thread::hardware_concurrency()))),
+		framesTile(max((nFrames + nTiles - 1) / nTiles, static_cast<size_t>(1)));
+	vector<vector<float>> tileAggr((nFrames + framesTile - 1) / framesTile);
+	ParallelFor(tileAggr.size(), [&](const size_t tile)
+	{
+		vector<float> frame(static_cast<size_t>(nDft) + 1);
+		vector<Ipp8u> workBuf(static_cast<size_t>(workSize));
+		vector<double> slide(isSliding ? win : 0);
+		const auto x(paddedEnvelope.data());
+
+		auto& result(tileAggr.at(tile));
+		const auto lastFrame(min(nFrames, (tile + 1) * framesTile));
+		for (auto j(tile * framesTile); j < lastFrame; ++j)
+		{
+			const auto t(j * step);
+			if (isSliding and j == tile * framesTile) for (size_t k(0); k < win; ++k)
+			{
+				slide.at(k) = 0;
+				for (size_t n(0); n + k < win; ++n) slide.at(k) += static_cast<double>(x[t + n]) * x[t + n + k];
+			}
+			else if (isSliding) for (auto s(t - step); s < t; ++s) for (size_t k(0); k < win; ++k)
+				slide.at(k) += static_cast<double>(x[s + win - k]) * x[s + win]
+					- static_cast<double>(x[s]) * x[s + k];
+
+			if (isSliding) for (size_t k(0); k < win; ++k) frame.at(k) = static_cast<float>(slide.at(k));
+			else
+			{
+				CHECK_IPP_RESULT(ippsMul_32f(x + static_cast<ptrdiff_t>(t), winTable.data(), frame.data(), winLen));
+				CHECK_IPP_RESULT(ippsZero_32f(frame.data() + winLen, nDft + 1 - winLen));
+				AutoCorrelate(frame.data(), nDft, spec, workBuf.data());
+			}
+
+			Ipp32f norm32(0);
+			CHECK_IPP_RESULT(NormFunc(frame.data(), winLen, &norm32));
+			if (norm32) CHECK_IPP_RESULT(ippsDivC_32f_I(norm32, frame.data(), winLen));
+
+			// Median needs all the frames, other aggregates are accumulated right away:
+			if (aggr == AGGREGATE::MEDIAN) CHECK_IPP_RESULT(ippsCopy_32f(frame.data(),
+				autoCorr_.data() + static_cast<ptrdiff_t>(j * win), winLen));
+			else if (result.empty()) result.assign(frame.cbegin(), frame.cbegin() + winLen);
+			else switch (aggr)
+			{
+			case AGGREGATE::MEAN: CHECK_IPP_RESULT(ippsAdd_32f_I(frame.data(), result.data(), winLen));	break;
+			case AGGREGATE::MIN: CHECK_IPP_RESULT(ippsMinEvery_32f_I(frame.data(),
+				result.data(), static_cast<Ipp32u>(winLen)));											break;
+			case AGGREGATE::MAX: CHECK_IPP_RESULT(ippsMaxEvery_32f_I(frame.data(),
+				result.data(), static_cast<Ipp32u>(winLen)));											break;
+			default: assert(!"Not all aggregating functions checked");
+			}
+		}
+	});
+
+	tempos_.resize(win);
+	if (aggr == AGGREGATE::MEDIAN)
 	{
-		unusedIter = copy(paddedEnvelope.cbegin() + static_cast<ptrdiff_t>(i),
-			paddedEnvelope.cbegin() + static_cast<ptrdiff_t>(i + winLen), autoCorr2D_.at(i).begin());
-		WinFunc->multiplyWithWindowingTable(autoCorr2D_.at(i).data(), autoCorr2D_.at(i).size());
-		AutoCorrelate(&autoCorr2D_.at(i));
-
-		Ipp32f norm32(0);
-		CHECK_IPP_RESULT(NormFunc(autoCorr2D_.at(i).data(),
-			static_cast<int>(autoCorr2D_.at(i).size()), &norm32));
-		if (norm32) CHECK_IPP_RESULT(ippsDivC_32f_I(norm32,
-			autoCorr2D_.at(i).data(), static_cast<int>(autoCorr2D_.at(i).size())));
+		AggregateColumns(autoCorr_.data(), static_cast<int>(nFrames), winLen, tempos_.data(), aggr);
+		return;
+	}
+	// Frame tiles are combined the same way as frames:
+	tempos_ = tileAggr.front();
+	for (size_t i(1); i < tileAggr.size(); ++i) switch (aggr)
+	{
+	case AGGREGATE::MEAN: CHECK_IPP_RESULT(ippsAdd_32f_I(tileAggr.at(i).data(), tempos_.data(), winLen));	break;
+	case AGGREGATE::MIN: CHECK_IPP_RESULT(ippsMinEvery_32f_I(tileAggr.at(i).data(),
+		tempos_.data(), static_cast<Ipp32u>(winLen)));														break;
+	case AGGREGATE::MAX: CHECK_IPP_RESULT(ippsMaxEvery_32f_I(tileAggr.at(i).data(),
+		tempos_.data(), static_cast<Ipp32u>(winLen)));														break;
+	default: assert(!"Not all aggregating functions checked");
 	}
+	if (aggr == AGGREGATE::MEAN) CHECK_IPP_RESULT(ippsDivC_32f_I(
+		static_cast<Ipp32f>(nFrames), tempos_.data(), winLen));
 }
 
 float Tempogram::MostProbableTempo(const vector<float>& oEnv, const int rate, const int hopLen,
 	const int startBpm, const float stdBpm, const float acSize,
-	const float maxTempo, const AGGREGATE aggr)
+	const float maxTempo, const AGGREGATE aggr, const int hop, const WIN_FUNC window)
 {
 	assert(startBpm > 0 and "Start BPM must be positive and non-zero");
 	assert(acSize > 0 and "Length in seconds of the auto-correlation window must be > 0");
 
-	Calculate(oEnv, static_cast<int>(Divide(Multiply(acSize, rate), hopLen)));
-	if (autoCorr2D_.empty()) return 0; // audio is too short
-
+	const auto winLen(static_cast<int>(Divide(Multiply(acSize, rate), hopLen)));
 	// If want to estimate time-varying tempo independently for each frame,
 	// just do not aggregate, but now we need only average tempo:
-	AlignedVector<float> autoCorrFlat(autoCorr2D_.size() * autoCorr2D_.front().size());
-	for (size_t i(0); i < autoCorr2D_.size(); ++i) const auto unusedIter(copy(
-		autoCorr2D_.at(i).cbegin(), autoCorr2D_.at(i).cend(),
-		autoCorrFlat.begin() + static_cast<ptrdiff_t>(i * autoCorr2D_.at(i).size())));
-	MKL_Simatcopy('R', 'T', autoCorr2D_.size(), autoCorr2D_.front().size(),
-		1, autoCorrFlat.data(), autoCorr2D_.front().size(), autoCorr2D_.size());
-	vector<float> tempos(autoCorr2D_.front().size());
-	Aggregate(autoCorrFlat.data(), static_cast<int>(autoCorr2D_.front().size()), 0,
-		static_cast<int>(autoCorr2D_.size()), tempos.data(), aggr);
+	Calculate(oEnv, winLen, hop, true, window, NORM_TYPE::INF, aggr);
+	if (tempos_.empty()) return 0; // audio is too short
 
 	// Bin frequencies, corresponding to an onset auto-correlation or tempogram matrix:
-	vector<float> bpms(tempos.size()), prior(tempos.size(), 0);
+	vector<float> bpms(tempos_.size()), prior(tempos_.size(), 0);
 	bpms.front() = 0; // zero-lag bin skipped
 	for (size_t i(1); i < prior.size(); ++i)
 	{
@@ -130,7 +177,7 @@ float Tempogram::MostProbableTempo(const vector<float>& oEnv, const int rate, co
 		// Kill everything above the max tempo:
 		if (maxTempo > numeric_limits<float>::epsilon() and bpms.at(i) <= maxTempo)
 			// Weight the autocorrelation by a log-normal distribution:
-			prior.at(i) = tempos.at(i) * exp(-Divide(pow((log2(bpms.at(i))
+			prior.at(i) = tempos_.at(i) * exp(-Divide(pow((log2(bpms.at(i))
 				- log2(static_cast<float>(startBpm))) / stdBpm, 2), 2));
 	}
 
@@ -6,10 +6,14 @@ public:
 	float MostProbableTempo(const std::vector<float>& onsetEnvelope, int sampleRate, int hopLength,
 		int startBpm = 120, float stdBpm = 1.f, float acSize = 8.f,
 		float maxTempo = 320.f, // if zero, no threshold will be performed
-		AGGREGATE aggr = AGGREGATE::MEAN);
+		AGGREGATE aggr = AGGREGATE::MEAN, int hop = 1, WIN_FUNC window = WIN_FUNC::HANN);
 private:
-	void Calculate(const std::vector<float>& onsetEnvelope, int winLength = 384,
-		bool toCenter = true, WIN_FUNC window = WIN_FUNC::HANN, NORM_TYPE norm = NORM_TYPE::INF);
+	// Only the aggregate over frames is kept, except for median, which needs all of them.
+	// With rectangular window, auto-correlation of every frame is updated from the previous one:
+	void Calculate(const std::vector<float>& onsetEnvelope, int winLength = 384, int hop = 1,
+		bool toCenter = true, WIN_FUNC window = WIN_FUNC::HANN, NORM_TYPE norm = NORM_TYPE::INF,
+		AGGREGATE aggr = AGGREGATE::MEAN);
 
-	std::vector<std::vector<float>> autoCorr2D_;
+	AlignedVector<float> autoCorr_; // frame-major: one row of auto-correlation lags per frame
+	std::vector<float> tempos_; // auto-correlation lags aggregated over frames
 };
\ No newline at end of file